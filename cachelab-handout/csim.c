@@ -1,128 +1,3394 @@
+// madvise, clock_gettime and posix_memalign are POSIX, -std=c99 hides them otherwise
+#define _DEFAULT_SOURCE
 #include "cachelab.h"
+#include "csim.h"
 #include <unistd.h>
 #include <stdio.h>
-#include <limits.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <math.h>
 
-typedef struct {
-    bool valid;
-    unsigned tag;
-    unsigned lru_mark;
-} line;
-typedef struct {
-    line* lines;
-} set;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSIM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * a set probe returns the way among `n` lines holding `tag`, or -1
+ */
+typedef int (*probe_func)(const unsigned long long* tags, const unsigned char* valid, int n, unsigned long long tag);
+
+/*
+ * replacement policies, selected with -p
+ *  LRU and FIFO share the recency list (FIFO just ignores hits), the others
+ *  keep their own per-line or per-set state
+ */
+enum {
+    POLICY_LRU,
+    POLICY_FIFO,
+    POLICY_RANDOM,
+    POLICY_PLRU,
+    POLICY_SRRIP,
+    POLICY_LFU,
+    POLICY_NUM
+};
+
+static const char* policy_names[POLICY_NUM] = {"lru", "fifo", "random", "plru", "srrip", "lfu"};
+
+#define SRRIP_MAX_RRPV 3
+
+/*
+ * set index functions, selected with -i
+ *  - mod: the low set bits of the block number
+ *  - xor: the block number folded onto itself in set-bit wide chunks
+ *  - hash: every set bit is the parity of the block number under a fixed mask
+ *      holding that bit plus pseudo-random bits above the index, like the
+ *      slice hashing of sliced last-level caches
+ *  tags hold the whole block number, so any index function can be inverted
+ */
+enum {
+    INDEX_MOD,
+    INDEX_XOR,
+    INDEX_HASH,
+    INDEX_NUM
+};
+
+static const char* index_names[INDEX_NUM] = {"mod", "xor", "hash"};
+
+/*
+ * hardware prefetchers, selected with --prefetch
+ *  - next: on a miss (or the first hit on a prefetched line) fetch the next
+ *      `degree` blocks
+ *  - stride: a table indexed by 4KB region learns the stride between accesses
+ *      in the region and, once it repeats, fetches `degree` strides ahead
+ *      (lackey traces carry no pc, so the table is per region, not per pc)
+ *  - stream: misses close to a tracked stream confirm its direction, then the
+ *      next `degree` blocks along it are fetched
+ */
+enum {
+    PREFETCH_NONE,
+    PREFETCH_NEXT,
+    PREFETCH_STRIDE,
+    PREFETCH_STREAM,
+    PREFETCH_NUM
+};
+
+#ifndef CSIM_NO_MAIN
+static const char* prefetch_names[PREFETCH_NUM] = {"none", "next", "stride", "stream"};
+#endif
+
+#define MAX_SET_BITS 30                 // set_num is an int
+
+/*
+ * lines are stored as a structure of arrays in one contiguous allocation:
+ *  line `i` of set `k` lives at index `k * line_num + i` of each per-line array.
+ *  each set keeps its lines on an intrusive doubly-linked recency list
+ *  (`prev`/`next` hold line numbers within the set): `mru` is the most recently
+ *  used line, `lru` the replacement victim. invalid lines sit at the lru end,
+ *  so a fill always takes `lru`.
+ *  `dirty` marks lines that differ from the next level. stores follow
+ *  `write_through` / `write_allocate` (write-back, write-allocate by default),
+ *  `bytes_read` / `bytes_written` count the traffic to the next level.
+ *  policy state only exists for the policy in use: `plru` holds the E - 1 tree
+ *  bits of each set (E bytes per set), `rrpv` and `freq` one value per line,
+ *  `filled` counts the valid lines of each set and `draws` the random victims
+ *  picked in it.
+ *  `prefetched` is only allocated when a prefetcher runs and marks lines filled
+ *  by a prefetch that no demand access has used yet, `pollution_evictions`
+ *  counts such lines evicted before any use.
+ */
 typedef struct {
     int set_num;
     int line_num;
-    set* sets;
+    int set_bits;
+    int block_bits;
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long writebacks;
+    long long bytes_read;
+    long long bytes_written;
+    long long prefetches;
+    long long prefetch_hits;
+    long long useful_prefetches;
+    long long pollution_evictions;
+    bool write_through;
+    bool write_allocate;
+    unsigned long long* tags;
+    unsigned char* dirty;
+    unsigned char* valid;
+    unsigned char* prefetched;
+    int* prev;
+    int* next;
+    int* mru;
+    int* lru;
+    int policy;
+    int index_fn;
+    unsigned long long index_masks[MAX_SET_BITS];
+    unsigned char* plru;
+    unsigned char* rrpv;
+    unsigned* freq;
+    int* filled;
+    unsigned* draws;
+    probe_func probe;
+    void* storage;
 } cache_struct;
 
-int misses;
-int hits;
-int evictions;
+typedef struct {
+    char op;
+    unsigned long long addr;
+    int size;
+    int core;
+} trace_record;
+/*
+ * a trace read from a pipe (`-t -`) is consumed in chunks: a reader thread
+ * fills one chunk while the scanner walks the other. chunks are cut after the
+ * last newline they hold, the partial line is carried into the next one, so
+ * records never straddle chunks and memory stays at three chunks.
+ */
+#define STREAM_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+    char* data;
+    size_t length;
+    bool full;
+} stream_chunk;
+
+typedef struct {
+    int fd;
+    stream_chunk chunks[2];
+    int current;
+    bool eof;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+} trace_stream;
+
+typedef struct {
+    char* base;
+    size_t length;
+    trace_stream* stream;
+    const char* cur;
+    const char* end;
+    bool binary;
+    unsigned long long last_inst_addr;
+    unsigned long long last_data_addr;
+} trace_reader;
+
+/*
+ * packed binary trace format
+ *  - file starts with the 8-byte magic TRACE_MAGIC
+ *  - each record starts with one byte: bits 0-1 op code, bits 2-7 access size
+ *      (TRACE_SIZE_ESCAPE means the size follows as a varint)
+ *  - then the zigzag-encoded address delta as a LEB128 varint, relative to the
+ *      previous address of the same stream (instruction fetches vs data accesses)
+ */
+#define TRACE_MAGIC "CSIMBT01"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_SIZE_ESCAPE 63
+
+#ifndef CSIM_NO_MAIN
+static const char trace_op_chars[] = "ILSM";
+#endif
+
+/*
+ * carve - hand out the next `size` bytes of `*cursor`, 64-byte aligned
+ */
+static void* carve(char** cursor, size_t size)
+{
+    void* p = *cursor;
+    *cursor += (size + 63) & ~(size_t) 63;
+    return p;
+}
+
+static int probe_scalar(const unsigned long long* tags, const unsigned char* valid, int n, unsigned long long tag)
+{
+    int i;
+    for (i = 0; i < n; ++i)
+        if (tags[i] == tag && valid[i]) return i;
+    return -1;
+}
+
+#ifdef CSIM_X86_SIMD
+/*
+ * the vector probes compare a block of tags at once and walk the movemask;
+ *  a matching tag only counts if its line is valid, so stale tags are skipped
+ */
+__attribute__((target("sse4.1")))
+static int probe_sse41(const unsigned long long* tags, const unsigned char* valid, int n, unsigned long long tag)
+{
+    __m128i key = _mm_set1_epi64x(tag);
+    unsigned mask;
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i lo = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*) (tags + i)), key);
+        __m128i hi = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*) (tags + i + 2)), key);
+        mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) | (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+        for (; mask; mask &= mask - 1)
+            if (valid[i + __builtin_ctz(mask)]) return i + __builtin_ctz(mask);
+    }
+    for (; i < n; ++i)
+        if (tags[i] == tag && valid[i]) return i;
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int probe_avx2(const unsigned long long* tags, const unsigned char* valid, int n, unsigned long long tag)
+{
+    __m256i key = _mm256_set1_epi64x(tag);
+    unsigned mask;
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (tags + i)), key);
+        __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (tags + i + 4)), key);
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+        for (; mask; mask &= mask - 1)
+            if (valid[i + __builtin_ctz(mask)]) return i + __builtin_ctz(mask);
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (tags + i));
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(block, key)));
+        for (; mask; mask &= mask - 1)
+            if (valid[i + __builtin_ctz(mask)]) return i + __builtin_ctz(mask);
+    }
+    for (; i < n; ++i)
+        if (tags[i] == tag && valid[i]) return i;
+    return -1;
+}
+#endif
+
+/*
+ * select_probe - pick the widest set probe the cpu supports (checked via cpuid)
+ *  narrow sets stay scalar, the vector setup does not pay off below one block
+ */
+static probe_func select_probe(int E)
+{
+#ifdef CSIM_X86_SIMD
+    __builtin_cpu_init();
+    if (E >= 8 && __builtin_cpu_supports("avx2")) return probe_avx2;
+    if (E >= 4 && __builtin_cpu_supports("sse4.1")) return probe_sse41;
+#endif
+    return probe_scalar;
+}
+
+/*
+ * init_cache - allocate and reset a cache of 2^s sets of E lines of 2^b bytes
+ *  returns CACHE_OK, or the reason the cache could not be built; nothing is
+ *  allocated on failure
+ */
+enum {
+    CACHE_OK,
+    CACHE_TOO_MANY_SETS,
+    CACHE_BAD_WAYS,
+    CACHE_PLRU_WAYS,
+    CACHE_NO_MEMORY
+};
+
+static int init_cache(cache_struct* cache, int s, int E, int b, int policy, int index_fn)
+{
+    size_t i, line_total, set_total, bytes;
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL, bits;
+    int j;
+    bool list_policy = policy == POLICY_LRU || policy == POLICY_FIFO;
+    char* cursor;
+    if (s > MAX_SET_BITS) return CACHE_TOO_MANY_SETS;
+    cache -> set_num = 1 << s;
+    cache -> line_num = E;
+    cache -> set_bits = s;
+    cache -> block_bits = b;
+    cache -> policy = policy;
+    cache -> index_fn = index_fn;
+    cache -> hits = cache -> misses = cache -> evictions = cache -> writebacks = 0;
+    cache -> bytes_read = cache -> bytes_written = 0;
+    cache -> prefetches = cache -> prefetch_hits = cache -> useful_prefetches = cache -> pollution_evictions = 0;
+    cache -> prefetched = NULL;
+    cache -> write_through = false;
+    cache -> write_allocate = true;
+    line_total = (size_t) cache->set_num * cache->line_num;
+    set_total = cache->set_num;
+
+    for (j = 0; j < s; ++j) {
+        // splitmix64, so the hash masks are the same on every run
+        bits = (seed += 0x9e3779b97f4a7c15ULL);
+        bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebULL;
+        bits ^= bits >> 31;
+        cache->index_masks[j] = (1ULL << j) | (bits & ~((1ULL << s) - 1));
+    }
+
+    if (E < 1) return CACHE_BAD_WAYS;
+    if (policy == POLICY_PLRU && (E & (E - 1))) return CACHE_PLRU_WAYS;
+
+    bytes = 64 * 13 + line_total * (sizeof(unsigned long long) + 2);
+    if (list_policy) bytes += line_total * 2 * sizeof(int) + set_total * 2 * sizeof(int);
+    else bytes += set_total * (sizeof(int) + sizeof(unsigned))
+                + line_total * (policy == POLICY_LFU ? sizeof(unsigned) : 1);
+    if (posix_memalign(&cache->storage, 64, (bytes + 63) & ~(size_t) 63) != 0) return CACHE_NO_MEMORY;
+    cursor = cache->storage;
+    cache->tags = carve(&cursor, line_total * sizeof(unsigned long long));
+    cache->prev = list_policy ? carve(&cursor, line_total * sizeof(int)) : NULL;
+    cache->next = list_policy ? carve(&cursor, line_total * sizeof(int)) : NULL;
+    cache->mru = list_policy ? carve(&cursor, set_total * sizeof(int)) : NULL;
+    cache->lru = list_policy ? carve(&cursor, set_total * sizeof(int)) : NULL;
+    cache->filled = list_policy ? NULL : carve(&cursor, set_total * sizeof(int));
+    cache->draws = list_policy ? NULL : carve(&cursor, set_total * sizeof(unsigned));
+    cache->freq = policy == POLICY_LFU ? carve(&cursor, line_total * sizeof(unsigned)) : NULL;
+    cache->plru = policy == POLICY_PLRU ? carve(&cursor, line_total) : NULL;
+    cache->rrpv = policy == POLICY_SRRIP ? carve(&cursor, line_total) : NULL;
+    cache->valid = carve(&cursor, line_total);
+    cache->dirty = carve(&cursor, line_total);
+    cache->probe = select_probe(E);
+
+    memset(cache->tags, 0, line_total * sizeof(unsigned long long));
+    memset(cache->valid, 0, line_total);
+    memset(cache->dirty, 0, line_total);
+    if (list_policy) {
+        for (i = 0; i < line_total; i += cache->line_num)
+            for (j = 0; j < cache->line_num; ++j)
+            {
+                cache->prev[i + j] = j - 1;
+                cache->next[i + j] = j + 1 < cache->line_num ? j + 1 : -1;
+            }
+        for (j = 0; j < cache->set_num; ++j)
+        {
+            cache->mru[j] = 0;
+            cache->lru[j] = cache->line_num - 1;
+        }
+    }
+    else {
+        memset(cache->filled, 0, set_total * sizeof(int));
+        memset(cache->draws, 0, set_total * sizeof(unsigned));
+        if (cache->freq) memset(cache->freq, 0, line_total * sizeof(unsigned));
+        if (cache->plru) memset(cache->plru, 0, line_total);
+        if (cache->rrpv) memset(cache->rrpv, SRRIP_MAX_RRPV, line_total);
+    }
+    return CACHE_OK;
+}
+
+static void free_cache(cache_struct* cache)
+{
+    free(cache->storage);
+    free(cache->prefetched);
+}
+
+/*
+ * update_lru - move the given line to the mru end of its set, O(1)
+ */
+static void update_lru(cache_struct* cache, int set_index, int line_index)
+{
+    size_t base = (size_t) set_index * cache->line_num;
+    int* prev = cache->prev + base;
+    int* next = cache->next + base;
+    int before = prev[line_index];
+    int after = next[line_index];
+    int mru = cache->mru[set_index];
+
+    if (line_index == mru) return;
+    // unlink (before is valid since the line is not the mru)
+    next[before] = after;
+    if (after != -1) prev[after] = before;
+    else cache->lru[set_index] = before;
+    // push front
+    prev[line_index] = -1;
+    next[line_index] = mru;
+    prev[mru] = line_index;
+    cache->mru[set_index] = line_index;
+}
+
+#ifndef CSIM_NO_MAIN
+/*
+ * demote_lru - move the given line to the lru end of its set, O(1)
+ */
+static void demote_lru(cache_struct* cache, int set_index, int line_index)
+{
+    size_t base = (size_t) set_index * cache->line_num;
+    int* prev = cache->prev + base;
+    int* next = cache->next + base;
+    int before = prev[line_index];
+    int after = next[line_index];
+    int lru = cache->lru[set_index];
+
+    if (line_index == lru) return;
+    // unlink (after is valid since the line is not the lru)
+    prev[after] = before;
+    if (before != -1) next[before] = after;
+    else cache->mru[set_index] = after;
+    // push back
+    next[line_index] = -1;
+    prev[line_index] = lru;
+    next[lru] = line_index;
+    cache->lru[set_index] = line_index;
+}
+#endif
+
+/*
+ * update_plru - point every tree node on the path to `line_index` away from it
+ *  node k has children 2k + 1 (bit 0) and 2k + 2 (bit 1)
+ */
+static inline void update_plru(cache_struct* cache, int set_index, int line_index)
+{
+    unsigned char* tree = cache->plru + (size_t) set_index * cache->line_num;
+    int node = 0, half = cache->line_num >> 1, lo = 0;
+    while (half) {
+        bool right = line_index >= lo + half;
+        tree[node] = !right;
+        node = 2 * node + 1 + right;
+        if (right) lo += half;
+        half >>= 1;
+    }
+}
+
+static inline int plru_victim(cache_struct* cache, int set_index)
+{
+    const unsigned char* tree = cache->plru + (size_t) set_index * cache->line_num;
+    int node = 0, half = cache->line_num >> 1, lo = 0;
+    while (half) {
+        bool right = tree[node];
+        node = 2 * node + 1 + right;
+        if (right) lo += half;
+        half >>= 1;
+    }
+    return lo;
+}
+
+static inline int srrip_victim(cache_struct* cache, int set_index)
+{
+    unsigned char* rrpv = cache->rrpv + (size_t) set_index * cache->line_num;
+    int i;
+    for (;;) {
+        for (i = 0; i < cache->line_num; ++i)
+            if (rrpv[i] == SRRIP_MAX_RRPV) return i;
+        for (i = 0; i < cache->line_num; ++i) ++rrpv[i];
+    }
+}
+
+static inline int lfu_victim(cache_struct* cache, int set_index)
+{
+    const unsigned* freq = cache->freq + (size_t) set_index * cache->line_num;
+    int i, victim = 0;
+    for (i = 1; i < cache->line_num; ++i)
+        if (freq[i] < freq[victim]) victim = i;
+    return victim;
+}
+
+/*
+ * random_victim - a hash of the incoming tag and the number of draws in the set
+ *  keeps runs reproducible and independent of how sets are visited
+ */
+static inline int random_victim(cache_struct* cache, int set_index, unsigned long long tag)
+{
+    unsigned long long x = tag * 0x9e3779b97f4a7c15ULL ^ cache->draws[set_index]++;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x % cache->line_num;
+}
+
+/*
+ * the policy_* helpers are always inlined with a constant `policy`, so each
+ * case of the dispatch in access_cache compiles to a loop specialized for one
+ * policy, without indirect calls in the hot path
+ */
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static ALWAYS_INLINE void policy_touch(cache_struct* cache, int set_index, int line_index, const int policy)
+{
+    size_t line = (size_t) set_index * cache->line_num + line_index;
+    switch (policy) {
+        case POLICY_LRU:
+            update_lru(cache, set_index, line_index);
+            break;
+        case POLICY_PLRU:
+            update_plru(cache, set_index, line_index);
+            break;
+        case POLICY_SRRIP:
+            cache->rrpv[line] = 0;
+            break;
+        case POLICY_LFU:
+            ++cache->freq[line];
+            break;
+        default:
+            // fifo and random ignore hits
+            break;
+    }
+}
+
+static ALWAYS_INLINE int policy_victim(cache_struct* cache, int set_index, unsigned long long tag, const int policy)
+{
+    const unsigned char* valid;
+    int i;
+    if (policy == POLICY_LRU || policy == POLICY_FIFO) return cache->lru[set_index];
+    if (cache->filled[set_index] < cache->line_num) {
+        valid = cache->valid + (size_t) set_index * cache->line_num;
+        for (i = 0; valid[i]; ++i);
+        return i;
+    }
+    switch (policy) {
+        case POLICY_RANDOM:
+            return random_victim(cache, set_index, tag);
+        case POLICY_PLRU:
+            return plru_victim(cache, set_index);
+        case POLICY_SRRIP:
+            return srrip_victim(cache, set_index);
+        default:
+            return lfu_victim(cache, set_index);
+    }
+}
+
+static ALWAYS_INLINE void policy_fill(cache_struct* cache, int set_index, int line_index, bool was_valid, const int policy)
+{
+    size_t line = (size_t) set_index * cache->line_num + line_index;
+    if (policy != POLICY_LRU && policy != POLICY_FIFO && !was_valid) ++cache->filled[set_index];
+    switch (policy) {
+        case POLICY_LRU:
+        case POLICY_FIFO:
+            update_lru(cache, set_index, line_index);
+            break;
+        case POLICY_PLRU:
+            update_plru(cache, set_index, line_index);
+            break;
+        case POLICY_SRRIP:
+            cache->rrpv[line] = SRRIP_MAX_RRPV - 1;
+            break;
+        case POLICY_LFU:
+            cache->freq[line] = 1;
+            break;
+    }
+}
+
+/*
+ * update_line - fill `tag` into the victim line of the set
+ *  `prefetch` marks a fill made by a prefetcher rather than a demand miss,
+ *  evicting a prefetched line no demand access used is a pollution eviction
+ *  returns true if a valid line had to be evicted
+ */
+static ALWAYS_INLINE bool update_line(cache_struct* cache, int set_index, unsigned long long tag, bool dirty,
+                                      bool prefetch, const int policy)
+{
+    int victim = policy_victim(cache, set_index, tag, policy);
+    size_t line = (size_t) set_index * cache->line_num + victim;
+    bool is_full = cache->valid[line];
+
+    if (is_full && cache->dirty[line]) {
+        ++cache->writebacks;
+        cache->bytes_written += 1LL << cache->block_bits;
+    }
+    cache->valid[line] = true;
+    cache->dirty[line] = dirty;
+    cache->tags[line] = tag;
+    if (cache->prefetched) {
+        if (is_full && cache->prefetched[line]) ++cache->pollution_evictions;
+        cache->prefetched[line] = prefetch;
+    }
+    policy_fill(cache, set_index, victim, is_full, policy);
+    return is_full;
+}
+
+/*
+ * find_line - return the line of the set holding `tag`, or -1
+ */
+static inline int find_line(cache_struct* cache, int set_index, unsigned long long tag)
+{
+    size_t base = (size_t) set_index * cache->line_num;
+    if (cache->line_num < 4) return probe_scalar(cache->tags + base, cache->valid + base, cache->line_num, tag);
+    return cache->probe(cache->tags + base, cache->valid + base, cache->line_num, tag);
+}
+
+/*
+ * access_line - one load (`is_write` false) or a store of `size` bytes
+ *  a write-through store sends its bytes on, hit or miss; a store that misses
+ *  without write-allocate goes straight to the next level, nothing is filled
+ */
+static ALWAYS_INLINE void access_line(cache_struct* cache, int set_index, unsigned long long tag, bool is_write, int size,
+                                      bool verbose, const int policy)
+{
+    int i = find_line(cache, set_index, tag);
+    bool write_back = is_write && !cache->write_through;
+    if (is_write && cache->write_through) cache->bytes_written += size;
+    if (i >= 0) {
+        size_t line = (size_t) set_index * cache->line_num + i;
+        policy_touch(cache, set_index, i, policy);
+        if (write_back) cache->dirty[line] = true;
+        if (cache->prefetched && cache->prefetched[line]) {
+            cache->prefetched[line] = false;
+            ++cache->useful_prefetches;
+        }
+        ++cache->hits;
+        if (verbose) printf("hit ");
+    }
+    else {
+        ++cache->misses;
+        if (verbose) printf("miss ");
+        if (is_write && !cache->write_allocate) {
+            if (write_back) cache->bytes_written += size;
+            return;
+        }
+        cache->bytes_read += 1LL << cache->block_bits;
+        if (update_line(cache, set_index, tag, write_back, false, policy)) {
+            ++cache->evictions;
+            if (verbose) printf("eviction ");
+        }
+    }
+}
+
+static inline void access_cache(cache_struct* cache, int set_index, unsigned long long tag, bool is_write, int size,
+                                bool verbose)
+{
+    switch (cache->policy) {
+        case POLICY_LRU:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_LRU);
+            break;
+        case POLICY_FIFO:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_FIFO);
+            break;
+        case POLICY_RANDOM:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_RANDOM);
+            break;
+        case POLICY_PLRU:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_PLRU);
+            break;
+        case POLICY_SRRIP:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_SRRIP);
+            break;
+        case POLICY_LFU:
+            access_line(cache, set_index, tag, is_write, size, verbose, POLICY_LFU);
+            break;
+    }
+}
+
+static void load_cache(cache_struct* cache, int set_index, unsigned long long tag, bool verbose)
+{
+    access_cache(cache, set_index, tag, false, 0, verbose);
+}
+
+static void store_cache(cache_struct* cache, int set_index, unsigned long long tag, int size, bool verbose)
+{
+    access_cache(cache, set_index, tag, true, size, verbose);
+}
+
+static void modify_cache(cache_struct* cache, int set_index, unsigned long long tag, int size, bool verbose)
+{
+    load_cache(cache, set_index, tag, verbose);
+    store_cache(cache, set_index, tag, size, verbose);
+}
+
+/*
+ * block_set_index - the set of a block number under the given index function
+ */
+static ALWAYS_INLINE int block_set_index(const cache_struct* cache, unsigned long long block, const int index_fn)
+{
+    unsigned long long folded = 0;
+    int i, set_index = 0;
+    switch (index_fn) {
+        case INDEX_XOR:
+            if (!cache->set_bits) return 0;
+            for (; block; block >>= cache->set_bits) folded ^= block;
+            return folded & (cache->set_num - 1);
+        case INDEX_HASH:
+            for (i = 0; i < cache->set_bits; ++i)
+                set_index |= __builtin_parityll(block & cache->index_masks[i]) << i;
+            return set_index;
+        default:
+            return block & (cache->set_num - 1);
+    }
+}
+
+static ALWAYS_INLINE void replay_indexed(cache_struct* cache, const trace_record* record, bool verbose, const int index_fn)
+{
+    unsigned long long tag = record->addr >> cache->block_bits;
+    int set_index = block_set_index(cache, tag, index_fn);
+
+    if (verbose) printf("%c %llx,%d ", record->op, record->addr, record->size);
+    switch (record->op) {
+        case 'L':
+            load_cache(cache, set_index, tag, verbose);
+            break;
+        case 'S':
+            store_cache(cache, set_index, tag, record->size, verbose);
+            break;
+        case 'M':
+            modify_cache(cache, set_index, tag, record->size, verbose);
+            break;
+    }
+    if (verbose) printf("\n");
+}
+
+/*
+ * replay_record - feed one data access of the trace to the cache
+ *  the index function is a constant in each case, the mod path stays a mask
+ */
+static inline void replay_record(cache_struct* cache, const trace_record* record, bool verbose)
+{
+    switch (cache->index_fn) {
+        case INDEX_MOD:
+            replay_indexed(cache, record, verbose, INDEX_MOD);
+            break;
+        case INDEX_XOR:
+            replay_indexed(cache, record, verbose, INDEX_XOR);
+            break;
+        case INDEX_HASH:
+            replay_indexed(cache, record, verbose, INDEX_HASH);
+            break;
+    }
+}
+
+#ifndef CSIM_NO_MAIN
+/*
+ * init_cache_or_exit - init_cache for the command line, a cache that cannot
+ *  be built ends the run with a message
+ */
+static void init_cache_or_exit(cache_struct* cache, int s, int E, int b, int policy, int index_fn)
+{
+    switch (init_cache(cache, s, E, b, policy, index_fn)) {
+        case CACHE_TOO_MANY_SETS:
+            printf("too many set index bits!\n");
+            exit(1);
+        case CACHE_BAD_WAYS:
+            printf("associativity must be at least 1!\n");
+            exit(1);
+        case CACHE_PLRU_WAYS:
+            printf("plru needs a power of two associativity!\n");
+            exit(1);
+        case CACHE_NO_MEMORY:
+            printf("failed to allocate space!");
+            exit(0);
+    }
+}
+
+/*
+ * block level operations used by the multi-level modes. a block number is
+ * `addr >> b`, which is also its tag; its set comes from the index function.
+ * these dispatch on the policy at run time, only the single level path
+ * above is specialized per policy.
+ */
+
+/*
+ * lookup_block - return the line index (set * E + way) holding `block`, or -1
+ */
+static inline long lookup_block(cache_struct* cache, unsigned long long block)
+{
+    int set_index = block_set_index(cache, block, cache->index_fn);
+    int way = find_line(cache, set_index, block);
+    return way < 0 ? -1 : (long) set_index * cache->line_num + way;
+}
+
+static inline void touch_block(cache_struct* cache, long line)
+{
+    policy_touch(cache, line / cache->line_num, line % cache->line_num, cache->policy);
+}
+
+/*
+ * insert_block - fill `block` into its set
+ *  returns true if a valid line was evicted, reporting its block and dirty bit
+ */
+static bool insert_block(cache_struct* cache, unsigned long long block, bool dirty,
+                         unsigned long long* victim_block, bool* victim_dirty)
+{
+    int set_index = block_set_index(cache, block, cache->index_fn);
+    int way = policy_victim(cache, set_index, block, cache->policy);
+    size_t line = (size_t) set_index * cache->line_num + way;
+    bool evicted = cache->valid[line];
+
+    if (evicted) {
+        *victim_block = cache->tags[line];
+        *victim_dirty = cache->dirty[line];
+        ++cache->evictions;
+        if (*victim_dirty) ++cache->writebacks;
+    }
+    cache->valid[line] = true;
+    cache->dirty[line] = dirty;
+    cache->tags[line] = block;
+    policy_fill(cache, set_index, way, evicted, cache->policy);
+    return evicted;
+}
+
+/*
+ * invalidate_block - drop `block` if present
+ *  returns -1 if it was absent, otherwise its dirty bit
+ */
+static int invalidate_block(cache_struct* cache, unsigned long long block)
+{
+    long line = lookup_block(cache, block);
+    int set_index, way;
+    if (line < 0) return -1;
+    set_index = line / cache->line_num;
+    way = line % cache->line_num;
+    cache->valid[line] = false;
+    switch (cache->policy) {
+        case POLICY_LRU:
+        case POLICY_FIFO:
+            demote_lru(cache, set_index, way);
+            break;
+        case POLICY_SRRIP:
+            --cache->filled[set_index];
+            cache->rrpv[line] = SRRIP_MAX_RRPV;
+            break;
+        case POLICY_LFU:
+            --cache->filled[set_index];
+            cache->freq[line] = 0;
+            break;
+        default:
+            --cache->filled[set_index];
+            break;
+    }
+    return cache->dirty[line];
+}
+
+/*
+ * stream_reader - reader thread, fills the two chunks in turn, cut at the last newline
+ */
+static void* stream_reader(void* arg)
+{
+    trace_stream* stream = arg;
+    char* carry_data = malloc(STREAM_CHUNK_SIZE);
+    size_t carry = 0, n, keep;
+    ssize_t got;
+    bool eof = false;
+    int i = 0;
+
+    if (!carry_data) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    while (!eof) {
+        stream_chunk* chunk = &stream->chunks[i];
+        pthread_mutex_lock(&stream->lock);
+        while (chunk->full) pthread_cond_wait(&stream->changed, &stream->lock);
+        pthread_mutex_unlock(&stream->lock);
+
+        memcpy(chunk->data, carry_data, carry);
+        n = carry;
+        while (n < STREAM_CHUNK_SIZE) {
+            got = read(stream->fd, chunk->data + n, STREAM_CHUNK_SIZE - n);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                // a truncated trace would print a normal looking summary
+                perror("failed to read trace file");
+                exit(1);
+            }
+            if (got == 0) {
+                eof = true;
+                break;
+            }
+            n += got;
+        }
+        carry = 0;
+        if (!eof) {
+            // a chunk without any newline is one overlong line, pass it on whole
+            for (keep = n; keep > 0 && chunk->data[keep - 1] != '\n'; --keep);
+            if (keep > 0) {
+                carry = n - keep;
+                memcpy(carry_data, chunk->data + keep, carry);
+                n = keep;
+            }
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        chunk->length = n;
+        chunk->full = true;
+        stream->eof = eof;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+        i ^= 1;
+    }
+    free(carry_data);
+    return NULL;
+}
+
+/*
+ * stream_next_chunk - hand the finished chunk back to the reader thread and
+ *  wait for the next one, returns false at the end of the stream
+ */
+static bool stream_next_chunk(trace_reader* reader)
+{
+    trace_stream* stream = reader->stream;
+    int next = stream->current < 0 ? 0 : stream->current ^ 1;
+
+    pthread_mutex_lock(&stream->lock);
+    if (stream->current >= 0) {
+        stream->chunks[stream->current].full = false;
+        pthread_cond_broadcast(&stream->changed);
+    }
+    while (!stream->chunks[next].full && !stream->eof) pthread_cond_wait(&stream->changed, &stream->lock);
+    if (!stream->chunks[next].full) {
+        pthread_mutex_unlock(&stream->lock);
+        return false;
+    }
+    stream->current = next;
+    pthread_mutex_unlock(&stream->lock);
+
+    reader->cur = stream->chunks[next].data;
+    reader->end = stream->chunks[next].data + stream->chunks[next].length;
+    return true;
+}
+
+/*
+ * open_stream - read a text trace from `fd` through a reader thread
+ */
+static void open_stream(trace_reader* reader, int fd)
+{
+    trace_stream* stream = calloc(1, sizeof(trace_stream));
+    int i;
+    if (!stream) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    stream->fd = fd;
+    stream->current = -1;
+    for (i = 0; i < 2; ++i)
+        if (!(stream->chunks[i].data = malloc(STREAM_CHUNK_SIZE))) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    if (pthread_create(&stream->thread, NULL, stream_reader, stream) != 0) {
+        printf("failed to create thread!\n");
+        exit(1);
+    }
+    reader->stream = stream;
+    reader->base = NULL;
+    reader->length = 0;
+    reader->cur = reader->end = NULL;
+}
+
+/*
+ * close_stream - stop consuming; the reader thread is drained to the end of
+ *  the input so it can be joined
+ */
+static void close_stream(trace_stream* stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->eof) {
+        stream->chunks[0].full = stream->chunks[1].full = false;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+    stream->chunks[0].full = stream->chunks[1].full = false;
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+    if (stream->fd != STDIN_FILENO) close(stream->fd);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    free(stream->chunks[0].data);
+    free(stream->chunks[1].data);
+    free(stream);
+}
+
+/*
+ * open_trace - map the whole trace file into memory
+ *  the scanner below walks the mapping directly, so no line is ever copied;
+ *  stdin, pipes and files that cannot be mapped go through the stream reader
+ */
+void open_trace(trace_reader* reader, const char* file_name, bool binary)
+{
+    struct stat st;
+    int fd;
+
+    reader->binary = binary;
+    reader->last_inst_addr = 0;
+    reader->last_data_addr = 0;
+    reader->stream = NULL;
+    if (strcmp(file_name, "-") == 0) {
+        if (binary) {
+            printf("binary traces cannot be streamed!\n");
+            exit(1);
+        }
+        open_stream(reader, STDIN_FILENO);
+        return;
+    }
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("failed to open trace file!\n");
+        exit(1);
+    }
+    reader->base = NULL;
+    reader->length = st.st_size;
+    if (S_ISREG(st.st_mode) && reader->length > 0) {
+        reader->base = mmap(NULL, reader->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (reader->base == MAP_FAILED) reader->base = NULL;
+        else madvise(reader->base, reader->length, MADV_SEQUENTIAL);
+    }
+    // pipes, FIFOs and files that cannot be mapped are read like stdin
+    if (!reader->base && (!S_ISREG(st.st_mode) || reader->length > 0)) {
+        if (binary) {
+            printf("failed to map trace file!\n");
+            exit(1);
+        }
+        open_stream(reader, fd);
+        return;
+    }
+    close(fd);
+    reader->cur = reader->base;
+    reader->end = reader->base + reader->length;
+    if (binary) {
+        if (reader->length < TRACE_MAGIC_LEN || memcmp(reader->base, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+            printf("not a binary trace file!\n");
+            exit(1);
+        }
+        reader->cur += TRACE_MAGIC_LEN;
+    }
+}
+
+void close_trace(trace_reader* reader)
+{
+    if (reader->stream) close_stream(reader->stream);
+    if (reader->base) munmap(reader->base, reader->length);
+}
+
+static inline int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * next_text_head - scan the op and address of one " op addr,size" record
+ *  malformed lines are skipped, returns false at the end of the trace; `cur`
+ *  is left after the comma for finish_text_record or skip_text_record
+ */
+static inline bool next_text_head(trace_reader* reader, trace_record* record)
+{
+    const char* p = reader->cur;
+    const char* end = reader->end;
+    int digit;
+
+    for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+        if (p >= end) {
+            reader->cur = p;
+            return false;
+        }
+        record->op = *p++;
+        while (p < end && *p == ' ') ++p;
+
+        record->addr = 0;
+        while (p < end && (digit = hex_digit(*p)) >= 0) {
+            record->addr = (record->addr << 4) | digit;
+            ++p;
+        }
+        if (p < end && *p == ',') {
+            reader->cur = p + 1;
+            return true;
+        }
+        while (p < end && *p != '\n') ++p;
+    }
+}
+
+static inline void finish_text_record(trace_reader* reader, trace_record* record)
+{
+    const char* p = reader->cur;
+    const char* end = reader->end;
+
+    record->size = 0;
+    while (p < end && *p >= '0' && *p <= '9') record->size = record->size * 10 + (*p++ - '0');
+    record->core = 0;
+    if (p < end && *p == ',')
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p) record->core = record->core * 10 + (*p - '0');
+    while (p < end && *p != '\n') ++p;
+    reader->cur = p;
+}
+
+static inline void skip_text_record(trace_reader* reader)
+{
+    const char* p = memchr(reader->cur, '\n', reader->end - reader->cur);
+    reader->cur = p ? p : reader->end;
+}
+
+static inline bool read_varint(const unsigned char** pp, const unsigned char* end, unsigned long long* value)
+{
+    const unsigned char* p = *pp;
+    unsigned long long v = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+        unsigned char byte = *p++;
+        v |= (unsigned long long) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *pp = p;
+            *value = v;
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+/*
+ * next_binary_record - decode one record of a packed binary trace
+ *  returns false at the end of the trace (a truncated last record is dropped)
+ */
+static inline bool next_binary_record(trace_reader* reader, trace_record* record)
+{
+    const unsigned char* p = (const unsigned char*) reader->cur;
+    const unsigned char* end = (const unsigned char*) reader->end;
+    unsigned long long delta, size;
+    unsigned long long* last_addr;
+    unsigned char head;
+
+    if (p >= end) return false;
+    head = *p++;
+    if (!read_varint(&p, end, &delta)) return false;
+    size = head >> 2;
+    if (size == TRACE_SIZE_ESCAPE && !read_varint(&p, end, &size)) return false;
+
+    last_addr = (head & 3) == 0 ? &reader->last_inst_addr : &reader->last_data_addr;
+    *last_addr += (delta >> 1) ^ -(delta & 1);
+    record->op = trace_op_chars[head & 3];
+    record->addr = *last_addr;
+    record->size = size;
+    record->core = 0;
+    reader->cur = (const char*) p;
+    return true;
+}
+
+/*
+ * next_record_head - read the op and address of the next record
+ *  a binary record is decoded whole; the rest of a text record is read by
+ *  finish_record or passed over by skip_record, so filters that look only at
+ *  the address never scan the size
+ */
+static inline bool next_record_head(trace_reader* reader, trace_record* record)
+{
+    if (reader->binary) return next_binary_record(reader, record);
+    while (!next_text_head(reader, record))
+        if (!reader->stream || !stream_next_chunk(reader)) return false;
+    return true;
+}
+
+static inline void finish_record(trace_reader* reader, trace_record* record)
+{
+    if (!reader->binary) finish_text_record(reader, record);
+}
+
+static inline void skip_record(trace_reader* reader)
+{
+    if (!reader->binary) skip_text_record(reader);
+}
+
+static inline bool next_record(trace_reader* reader, trace_record* record)
+{
+    if (!next_record_head(reader, record)) return false;
+    finish_record(reader, record);
+    return true;
+}
+
+static inline unsigned char* write_varint(unsigned char* p, unsigned long long value)
+{
+    while (value >= 0x80) {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+/*
+ * convert_trace - rewrite a lackey text trace in the packed binary format
+ */
+void convert_trace(const char* text_file_name, const char* binary_file_name)
+{
+    trace_reader reader;
+    trace_record record;
+    unsigned long long last_addr[2] = {0, 0};
+    unsigned long long delta;
+    unsigned char buffer[32];
+    unsigned char* p;
+    const char* op;
+    int stream;
+
+    FILE* out = fopen(binary_file_name, "wb");
+    if (!out) {
+        printf("failed to create binary trace file!\n");
+        exit(1);
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, out);
+
+    open_trace(&reader, text_file_name, false);
+    while (next_record(&reader, &record))
+    {
+        if (!(op = memchr(trace_op_chars, record.op, 4))) continue;
+        stream = (op != trace_op_chars);
+        delta = (unsigned long long) record.addr - last_addr[stream];
+        last_addr[stream] = record.addr;
+
+        p = buffer;
+        if (record.size >= 0 && record.size < TRACE_SIZE_ESCAPE) {
+            *p++ = (op - trace_op_chars) | (record.size << 2);
+            p = write_varint(p, (delta << 1) ^ -(delta >> 63));
+        }
+        else {
+            *p++ = (op - trace_op_chars) | (TRACE_SIZE_ESCAPE << 2);
+            p = write_varint(p, (delta << 1) ^ -(delta >> 63));
+            p = write_varint(p, (unsigned) record.size);
+        }
+        fwrite(buffer, 1, p - buffer, out);
+    }
+    close_trace(&reader);
+
+    if (fclose(out) != 0) {
+        printf("failed to write binary trace file!\n");
+        exit(1);
+    }
+}
+
+/*
+ * addr_map - open addressing hash map from a 64-bit key to a dense id
+ *  ids are handed out in insertion order, so per-key data lives in plain
+ *  arrays indexed by id
+ */
+typedef struct {
+    unsigned long long* keys;
+    unsigned* ids;
+    size_t capacity;
+    size_t size;
+} addr_map;
+
+static inline size_t addr_hash(unsigned long long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+void addr_map_init(addr_map* map, size_t capacity)
+{
+    map->capacity = capacity;
+    map->size = 0;
+    map->keys = malloc(capacity * sizeof(unsigned long long));
+    // an id slot of 0 marks an empty bucket, stored ids are offset by one
+    map->ids = calloc(capacity, sizeof(unsigned));
+    if (!map->keys || !map->ids) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+}
+
+void addr_map_free(addr_map* map)
+{
+    free(map->keys);
+    free(map->ids);
+}
+
+static void addr_map_grow(addr_map* map)
+{
+    addr_map bigger;
+    size_t i, j;
+    addr_map_init(&bigger, map->capacity * 2);
+    for (i = 0; i < map->capacity; ++i)
+        if (map->ids[i]) {
+            for (j = addr_hash(map->keys[i]) & (bigger.capacity - 1); bigger.ids[j]; j = (j + 1) & (bigger.capacity - 1));
+            bigger.keys[j] = map->keys[i];
+            bigger.ids[j] = map->ids[i];
+        }
+    bigger.size = map->size;
+    addr_map_free(map);
+    *map = bigger;
+}
+
+/*
+ * addr_map_get - return the id of `key`, adding it if it is new
+ */
+static inline unsigned addr_map_get(addr_map* map, unsigned long long key, bool* inserted)
+{
+    size_t i;
+    if (map->size * 2 >= map->capacity) addr_map_grow(map);
+    for (i = addr_hash(key) & (map->capacity - 1); map->ids[i]; i = (i + 1) & (map->capacity - 1))
+        if (map->keys[i] == key) {
+            *inserted = false;
+            return map->ids[i] - 1;
+        }
+    map->keys[i] = key;
+    map->ids[i] = ++map->size;
+    *inserted = true;
+    return map->size - 1;
+}
+
+/*
+ * prefetcher state. the stride table is direct mapped on the region number,
+ * the stream table replaces its least recently matched entry.
+ */
+#define PREFETCH_REGION_BITS 12
+#define STRIDE_TABLE_SIZE 256
+#define STREAM_NUM 16
+#define STREAM_WINDOW 16
+
+typedef struct {
+    unsigned long long region;
+    unsigned long long last_addr;
+    long long stride;
+    int confidence;
+    bool valid;
+} stride_entry;
+
+typedef struct {
+    unsigned long long last_block;
+    int direction;
+    unsigned long long stamp;
+    bool valid;
+} stream_entry;
+
+typedef struct {
+    int type;
+    int degree;
+    unsigned long long clock;
+    stride_entry strides[STRIDE_TABLE_SIZE];
+    stream_entry streams[STREAM_NUM];
+} prefetcher;
+
+void init_prefetcher(prefetcher* pf, cache_struct* cache, int type, int degree)
+{
+    memset(pf, 0, sizeof(prefetcher));
+    pf->type = type;
+    pf->degree = degree;
+    cache->prefetched = calloc((size_t) cache->set_num * cache->line_num, 1);
+    if (!cache->prefetched) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+}
+
+/*
+ * prefetch_block - bring `block` in through update_line unless it is cached
+ *  a prefetch that finds the block present is a prefetch hit; the fill is
+ *  only counted as pollution once the line leaves the cache unused
+ */
+static void prefetch_block(cache_struct* cache, unsigned long long block)
+{
+    int set_index = block_set_index(cache, block, cache->index_fn);
+    if (find_line(cache, set_index, block) >= 0) {
+        ++cache->prefetch_hits;
+        return;
+    }
+    ++cache->prefetches;
+    cache->bytes_read += 1LL << cache->block_bits;
+    update_line(cache, set_index, block, false, true, cache->policy);
+}
+
+static void stride_train(prefetcher* pf, cache_struct* cache, unsigned long long addr)
+{
+    unsigned long long region = addr >> PREFETCH_REGION_BITS;
+    stride_entry* entry = &pf->strides[region & (STRIDE_TABLE_SIZE - 1)];
+    long long stride;
+    int i;
+
+    if (!entry->valid || entry->region != region) {
+        entry->valid = true;
+        entry->region = region;
+        entry->last_addr = addr;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+    stride = (long long) (addr - entry->last_addr);
+    if (!stride) return;
+    entry->last_addr = addr;
+    if (stride == entry->stride) {
+        if (entry->confidence < 3) ++entry->confidence;
+    }
+    else if (entry->confidence > 0) --entry->confidence;
+    else entry->stride = stride;
+    if (entry->confidence < 2) return;
+    for (i = 1; i <= pf->degree; ++i)
+        prefetch_block(cache, (addr + entry->stride * i) >> cache->block_bits);
+}
+
+static void stream_train(prefetcher* pf, cache_struct* cache, unsigned long long block)
+{
+    stream_entry* entry = NULL;
+    long long delta;
+    int i;
+
+    ++pf->clock;
+    for (i = 0; i < STREAM_NUM; ++i) {
+        stream_entry* candidate = &pf->streams[i];
+        if (!candidate->valid) continue;
+        delta = (long long) (block - candidate->last_block);
+        if (delta && delta >= -STREAM_WINDOW && delta <= STREAM_WINDOW
+            && (!candidate->direction || (delta > 0) == (candidate->direction > 0))) {
+            entry = candidate;
+            break;
+        }
+    }
+    if (!entry) {
+        entry = &pf->streams[0];
+        for (i = 0; i < STREAM_NUM && entry->valid; ++i)
+            if (!pf->streams[i].valid || pf->streams[i].stamp < entry->stamp) entry = &pf->streams[i];
+        entry->valid = true;
+        entry->last_block = block;
+        entry->direction = 0;
+        entry->stamp = pf->clock;
+        return;
+    }
+    entry->direction = block > entry->last_block ? 1 : -1;
+    entry->last_block = block;
+    entry->stamp = pf->clock;
+    for (i = 1; i <= pf->degree; ++i) prefetch_block(cache, block + (long long) entry->direction * i);
+}
+
+/*
+ * prefetch_access - train the prefetcher on one data record
+ *  `triggered` is set when the record missed or used a prefetched line, the
+ *  next line and stream prefetchers only act on those
+ */
+void prefetch_access(prefetcher* pf, cache_struct* cache, unsigned long long addr, bool triggered)
+{
+    unsigned long long block = addr >> cache->block_bits;
+    int i;
+    switch (pf->type) {
+        case PREFETCH_NEXT:
+            if (triggered)
+                for (i = 1; i <= pf->degree; ++i) prefetch_block(cache, block + i);
+            break;
+        case PREFETCH_STRIDE:
+            stride_train(pf, cache, addr);
+            break;
+        case PREFETCH_STREAM:
+            if (triggered) stream_train(pf, cache, block);
+            break;
+    }
+}
+
+void print_prefetch_stats(const prefetcher* pf, const cache_struct* cache)
+{
+    printf("prefetcher:%s degree:%d prefetches:%lld prefetch_hits:%lld useful_prefetches:%lld pollution_evictions:%lld\n",
+           prefetch_names[pf->type], pf->degree, cache->prefetches, cache->prefetch_hits, cache->useful_prefetches,
+           cache->pollution_evictions);
+}
+
+/*
+ * counter_table - access and miss counters per 64-bit key
+ *  the last key looked up is remembered, consecutive accesses to the same
+ *  page or region skip the hash probe
+ */
+typedef struct {
+    addr_map map;
+    long long* accesses;
+    long long* misses;
+    size_t capacity;
+    unsigned long long last_key;
+    long last_id;
+} counter_table;
+
+void counter_table_init(counter_table* table)
+{
+    addr_map_init(&table->map, 1 << 10);
+    table->capacity = 1 << 10;
+    table->accesses = malloc(table->capacity * sizeof(long long));
+    table->misses = malloc(table->capacity * sizeof(long long));
+    if (!table->accesses || !table->misses) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    table->last_id = -1;
+}
+
+void counter_table_free(counter_table* table)
+{
+    addr_map_free(&table->map);
+    free(table->accesses);
+    free(table->misses);
+}
+
+static inline void counter_table_add(counter_table* table, unsigned long long key, int accesses, int misses)
+{
+    bool inserted;
+    if (table->last_id < 0 || table->last_key != key) {
+        table->last_id = addr_map_get(&table->map, key, &inserted);
+        table->last_key = key;
+        if (inserted) {
+            if ((size_t) table->last_id == table->capacity) {
+                table->capacity *= 2;
+                table->accesses = realloc(table->accesses, table->capacity * sizeof(long long));
+                table->misses = realloc(table->misses, table->capacity * sizeof(long long));
+                if (!table->accesses || !table->misses) {
+                    printf("failed to allocate space!");
+                    exit(0);
+                }
+            }
+            table->accesses[table->last_id] = table->misses[table->last_id] = 0;
+        }
+    }
+    table->accesses[table->last_id] += accesses;
+    table->misses[table->last_id] += misses;
+}
+
+typedef struct {
+    long long count;
+    size_t id;
+} ranked_id;
+
+static int by_count_desc(const void* a, const void* b)
+{
+    long long x = ((const ranked_id*) a)->count, y = ((const ranked_id*) b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+ * print_top - print the `top` keys with the highest `counts`
+ *  `keys` maps an id to its key, NULL means the id is the key itself
+ */
+static void print_top(const char* title, const char* key_format, const char* count_name,
+                      const unsigned long long* keys, const long long* accesses, const long long* counts,
+                      size_t n, int top)
+{
+    ranked_id* order = malloc((n ? n : 1) * sizeof(ranked_id));
+    size_t i, id;
+    if (!order) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    for (i = 0; i < n; ++i) {
+        order[i].count = counts[i];
+        order[i].id = i;
+    }
+    qsort(order, n, sizeof(ranked_id), by_count_desc);
+    printf("top %d %s by %s:\n", top, title, count_name);
+    printf("%18s %14s %14s %10s\n", "key", "accesses", count_name, "rate");
+    for (i = 0; i < n && i < (size_t) top && order[i].count > 0; ++i) {
+        id = order[i].id;
+        printf(key_format, keys ? keys[id] : (unsigned long long) id);
+        printf(" %14lld %14lld %10.4f\n", accesses[id], counts[id], (double) counts[id] / accesses[id]);
+    }
+    free(order);
+}
+
+/*
+ * miss attribution: accesses and misses per 4KB page and per 2^region_bits
+ * byte region (hash tables) and per set (plain arrays), reported as top-N
+ * lists. lackey traces carry no program counter, so there is no per-pc view.
+ */
+#define PAGE_BITS 12
+
+typedef struct {
+    int region_bits;
+    int top;
+    counter_table pages;
+    counter_table regions;
+    long long* set_accesses;
+    long long* set_misses;
+    int set_num;
+} attribution;
+
+void init_attribution(attribution* attr, int set_num, int region_bits, int top)
+{
+    attr->region_bits = region_bits;
+    attr->top = top;
+    attr->set_num = set_num;
+    counter_table_init(&attr->pages);
+    counter_table_init(&attr->regions);
+    attr->set_accesses = calloc(set_num, sizeof(long long));
+    attr->set_misses = calloc(set_num, sizeof(long long));
+    if (!attr->set_accesses || !attr->set_misses) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+}
+
+void free_attribution(attribution* attr)
+{
+    counter_table_free(&attr->pages);
+    counter_table_free(&attr->regions);
+    free(attr->set_accesses);
+    free(attr->set_misses);
+}
+
+static inline void attribute_access(attribution* attr, unsigned long long addr, int set_index, int accesses, int misses)
+{
+    counter_table_add(&attr->pages, addr >> PAGE_BITS, accesses, misses);
+    counter_table_add(&attr->regions, addr >> attr->region_bits, accesses, misses);
+    attr->set_accesses[set_index] += accesses;
+    attr->set_misses[set_index] += misses;
+}
+
+/*
+ * print_attribution - top-N pages, regions and sets by misses
+ *  table keys are page and region base addresses
+ */
+void print_attribution(attribution* attr)
+{
+    counter_table* tables[2] = {&attr->pages, &attr->regions};
+    int shifts[2] = {PAGE_BITS, attr->region_bits};
+    char title[64];
+    size_t i, j;
+
+    for (i = 0; i < 2; ++i) {
+        unsigned long long* keys = malloc((tables[i]->map.size + 1) * sizeof(unsigned long long));
+        if (!keys) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+        for (j = 0; j < tables[i]->map.capacity; ++j)
+            if (tables[i]->map.ids[j]) keys[tables[i]->map.ids[j] - 1] = tables[i]->map.keys[j] << shifts[i];
+        if (i == 0) snprintf(title, sizeof(title), "4KB pages");
+        else snprintf(title, sizeof(title), "%d-bit regions", attr->region_bits);
+        print_top(title, "%#18llx", "misses", keys, tables[i]->accesses, tables[i]->misses, tables[i]->map.size, attr->top);
+        free(keys);
+    }
+    print_top("sets", "%18llu", "misses", NULL, attr->set_accesses, attr->set_misses, attr->set_num, attr->top);
+}
+
+/*
+ * 3C miss classification: a shadow fully associative LRU cache with as many
+ * lines as the real one runs beside it. every block gets a dense id from an
+ * addr_map, so a new id is a first touch (compulsory) and the shadow's LRU
+ * list is threaded through per-id arrays. a real miss that is not compulsory
+ * is a capacity miss if the shadow missed too, otherwise a conflict miss.
+ */
+#define SHADOW_NIL UINT_MAX
+
+typedef struct {
+    addr_map blocks;
+    unsigned* prev;
+    unsigned* next;
+    bool* resident;
+    size_t id_capacity;
+    unsigned mru, lru;
+    long line_num, resident_num;
+    long long compulsory, capacity, conflict;
+} miss_classifier;
+
+void init_classifier(miss_classifier* mc, long line_num)
+{
+    addr_map_init(&mc->blocks, 1 << 12);
+    mc->id_capacity = 1 << 12;
+    mc->prev = malloc(mc->id_capacity * sizeof(unsigned));
+    mc->next = malloc(mc->id_capacity * sizeof(unsigned));
+    mc->resident = malloc(mc->id_capacity * sizeof(bool));
+    if (!mc->prev || !mc->next || !mc->resident) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    mc->mru = mc->lru = SHADOW_NIL;
+    mc->line_num = line_num;
+    mc->resident_num = 0;
+    mc->compulsory = mc->capacity = mc->conflict = 0;
+}
+
+void free_classifier(miss_classifier* mc)
+{
+    addr_map_free(&mc->blocks);
+    free(mc->prev);
+    free(mc->next);
+    free(mc->resident);
+}
+
+static inline void shadow_unlink(miss_classifier* mc, unsigned id)
+{
+    if (mc->prev[id] != SHADOW_NIL) mc->next[mc->prev[id]] = mc->next[id];
+    else mc->mru = mc->next[id];
+    if (mc->next[id] != SHADOW_NIL) mc->prev[mc->next[id]] = mc->prev[id];
+    else mc->lru = mc->prev[id];
+}
+
+static inline void shadow_push_mru(miss_classifier* mc, unsigned id)
+{
+    mc->prev[id] = SHADOW_NIL;
+    mc->next[id] = mc->mru;
+    if (mc->mru != SHADOW_NIL) mc->prev[mc->mru] = id;
+    else mc->lru = id;
+    mc->mru = id;
+}
+
+/*
+ * classify_access - run `block` through the shadow cache and charge the
+ * `misses` the real cache took on this record to one of the three classes
+ */
+static inline void classify_access(miss_classifier* mc, unsigned long long block, long long misses)
+{
+    bool inserted, shadow_hit;
+    unsigned id = addr_map_get(&mc->blocks, block, &inserted);
+
+    if (inserted) {
+        if (id == mc->id_capacity) {
+            mc->id_capacity *= 2;
+            mc->prev = realloc(mc->prev, mc->id_capacity * sizeof(unsigned));
+            mc->next = realloc(mc->next, mc->id_capacity * sizeof(unsigned));
+            mc->resident = realloc(mc->resident, mc->id_capacity * sizeof(bool));
+            if (!mc->prev || !mc->next || !mc->resident) {
+                printf("failed to allocate space!");
+                exit(0);
+            }
+        }
+        mc->resident[id] = false;
+    }
+    shadow_hit = mc->resident[id];
+    if (shadow_hit) {
+        if (mc->mru != id) {
+            shadow_unlink(mc, id);
+            shadow_push_mru(mc, id);
+        }
+    }
+    else {
+        if (mc->resident_num == mc->line_num) {
+            unsigned victim = mc->lru;
+            shadow_unlink(mc, victim);
+            mc->resident[victim] = false;
+        }
+        else ++mc->resident_num;
+        mc->resident[id] = true;
+        shadow_push_mru(mc, id);
+    }
+
+    if (inserted) mc->compulsory += misses;
+    else if (!shadow_hit) mc->capacity += misses;
+    else mc->conflict += misses;
+}
+
+/*
+ * sampled replay for traces too long to simulate in full
+ *  - set sampling simulates only the sets whose index is a multiple of `rate`
+ *      and skips every other record
+ *  - time sampling repeats windows of `fast_forward` skipped records,
+ *      `warm_up` records replayed but not counted and `measure` counted ones
+ *  both estimate the miss rate as a ratio over the sampled units (sets or
+ *  windows) and scale it to all accesses of the trace; the 95% confidence
+ *  interval comes from the variance of that ratio estimator.
+ */
+#define CI_Z 1.96
+
+typedef struct {
+    long n;
+    double a, m, aa, mm, am;
+} ratio_sum;
+
+static void ratio_add(ratio_sum* rs, double accesses, double misses)
+{
+    ++rs->n;
+    rs->a += accesses;
+    rs->m += misses;
+    rs->aa += accesses * accesses;
+    rs->mm += misses * misses;
+    rs->am += accesses * misses;
+}
+
+/*
+ * ratio_half_width - half width of the confidence interval of m / a
+ *  `fpc` is the finite population correction, 1 when sampling an unbounded
+ *  population. NaN when fewer than 2 samples leave the width unknown
+ */
+static double ratio_half_width(const ratio_sum* rs, double fpc)
+{
+    double r, mean_a, var;
+    if (fpc == 0) return 0;
+    if (rs->n < 2 || rs->a == 0) return NAN;
+    r = rs->m / rs->a;
+    mean_a = rs->a / rs->n;
+    var = (rs->mm - 2 * r * rs->am + r * r * rs->aa) / (rs->n - 1);
+    if (var < 0) var = 0;
+    return CI_Z * sqrt(var / rs->n * fpc) / mean_a;
+}
+
+/*
+ * print_sampled - scale the sampled counts to the whole trace
+ *  evictions go through the same ratio estimator as the misses, a trace
+ *  never reports more evictions than misses, an unknown interval prints as n/a
+ */
+static void print_sampled(long long total, const ratio_sum* rs, double half, long long evictions)
+{
+    double rate = rs->a ? rs->m / rs->a : 0;
+    long long misses = (long long) (rate * total + 0.5);
+    long long scaled = rs->a ? (long long) (evictions / rs->a * total + 0.5) : 0;
+    printSummary(total - misses, misses, scaled < misses ? scaled : misses);
+    if (isnan(half))
+        printf("miss_rate:%.6f ci95:n/a misses_ci95:n/a sampled_accesses:%lld of %lld\n", rate, (long long) rs->a,
+               total);
+    else
+        printf("miss_rate:%.6f ci95:+-%.6f misses_ci95:+-%lld sampled_accesses:%lld of %lld\n", rate, half,
+               (long long) (half * total + 0.5), (long long) rs->a, total);
+}
+
+void run_set_sampled(cache_struct* cache, trace_reader* reader, int rate, bool verbose)
+{
+    long long* set_accesses = calloc(cache->set_num, sizeof(long long));
+    long long* set_misses = calloc(cache->set_num, sizeof(long long));
+    long long total = 0;
+    ratio_sum rs = {0};
+    trace_record record;
+    int set_index, sampled = 0;
+
+    if (!set_accesses || !set_misses) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    while (next_record_head(reader, &record)) {
+        long long misses = cache->misses;
+        int weight = record.op == 'M' ? 2 : 1;
+        set_index = block_set_index(cache, record.addr >> cache->block_bits, cache->index_fn);
+        if (record.op != 'I') total += weight;
+        if (record.op == 'I' || set_index % rate) {
+            skip_record(reader);
+            continue;
+        }
+        finish_record(reader, &record);
+        replay_record(cache, &record, verbose);
+        set_accesses[set_index] += weight;
+        set_misses[set_index] += cache->misses - misses;
+    }
+    for (set_index = 0; set_index < cache->set_num; set_index += rate) {
+        ratio_add(&rs, set_accesses[set_index], set_misses[set_index]);
+        ++sampled;
+    }
+    print_sampled(total, &rs, ratio_half_width(&rs, 1 - (double) sampled / cache->set_num), cache->evictions);
+    free(set_accesses);
+    free(set_misses);
+}
+
+void run_time_sampled(cache_struct* cache, trace_reader* reader, long long fast_forward, long long warm_up,
+                      long long measure, bool verbose)
+{
+    long long period = fast_forward + warm_up + measure, position = 0, total = 0;
+    long long window_accesses = 0, window_misses = 0, evictions = 0, window_evictions = 0;
+    ratio_sum rs = {0};
+    trace_record record;
+
+    while (next_record_head(reader, &record)) {
+        long long phase;
+        int weight = record.op == 'M' ? 2 : 1;
+        if (record.op == 'I') {
+            skip_record(reader);
+            continue;
+        }
+        total += weight;
+        phase = position++ % period;
+        if (phase < fast_forward) {
+            skip_record(reader);
+            continue;
+        }
+        finish_record(reader, &record);
+        if (phase == fast_forward + warm_up) {
+            window_misses = cache->misses;
+            window_evictions = cache->evictions;
+        }
+        replay_record(cache, &record, verbose);
+        if (phase < fast_forward + warm_up) continue;
+        window_accesses += weight;
+        if (phase == period - 1) {
+            ratio_add(&rs, window_accesses, cache->misses - window_misses);
+            evictions += cache->evictions - window_evictions;
+            window_accesses = 0;
+        }
+    }
+    if (window_accesses) {
+        ratio_add(&rs, window_accesses, cache->misses - window_misses);
+        evictions += cache->evictions - window_evictions;
+    }
+    print_sampled(total, &rs, ratio_half_width(&rs, 1), evictions);
+}
+
+/*
+ * sweep mode: the trace is decoded once into memory, then every (s, E, b)
+ * geometry of the sweep is replayed over it. worker threads pull geometries
+ * off a shared counter, so each cache is only ever touched by one thread.
+ */
+#define SWEEP_MAX_FIELD_VALUES 64
+
+typedef struct {
+    int s, E, b;
+    long long hits, misses, evictions;
+} sweep_config;
+
+typedef struct {
+    sweep_config* configs;
+    int config_num;
+    atomic_int next_config;
+    const trace_record* records;
+    size_t record_num;
+    int policy;
+    int index_fn;
+} sweep_job;
+
+/*
+ * load_trace_records - decode all data accesses of a trace into an array
+ */
+trace_record* load_trace_records(const char* file_name, bool binary, size_t* record_num)
+{
+    trace_reader reader;
+    trace_record record;
+    trace_record* records = NULL;
+    size_t capacity = 0, n = 0;
+
+    open_trace(&reader, file_name, binary);
+    while (next_record(&reader, &record))
+    {
+        if (record.op == 'I') continue;
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 1 << 16;
+            records = realloc(records, capacity * sizeof(trace_record));
+            if (!records) {
+                printf("failed to allocate space!");
+                exit(0);
+            }
+        }
+        records[n++] = record;
+    }
+    close_trace(&reader);
+    *record_num = n;
+    return records;
+}
+
+/*
+ * parse_sweep_field - parse "v", "lo-hi" or "v1/v2/..." into `values`
+ */
+static const char* parse_sweep_field(const char* p, int* values, int* n)
+{
+    char* end;
+    long lo, hi;
+
+    *n = 0;
+    do {
+        lo = strtol(p, &end, 10);
+        if (end == p) return NULL;
+        hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            if (end == p + 1) return NULL;
+            p = end;
+        }
+        for (; lo <= hi; ++lo) {
+            if (*n == SWEEP_MAX_FIELD_VALUES) return NULL;
+            values[(*n)++] = lo;
+        }
+    } while (*p == '/' && *++p);
+    return p;
+}
+
+/*
+ * parse_sweep_spec - expand a comma separated list of "s:E:b" grids,
+ *  e.g. "0-6:1/2/4/8:5,10:16:6"
+ */
+sweep_config* parse_sweep_spec(const char* spec, int* config_num)
+{
+    int s_values[SWEEP_MAX_FIELD_VALUES], E_values[SWEEP_MAX_FIELD_VALUES], b_values[SWEEP_MAX_FIELD_VALUES];
+    int s_n, E_n, b_n, i, j, k;
+    sweep_config* configs = NULL;
+    int n = 0;
+    const char* p = spec;
+
+    for (;;) {
+        if (!(p = parse_sweep_field(p, s_values, &s_n)) || *p++ != ':' ||
+            !(p = parse_sweep_field(p, E_values, &E_n)) || *p++ != ':' ||
+            !(p = parse_sweep_field(p, b_values, &b_n)) || (*p != ',' && *p != '\0')) {
+            printf("invalid sweep spec: %s\n", spec);
+            exit(1);
+        }
+        configs = realloc(configs, (n + s_n * E_n * b_n) * sizeof(sweep_config));
+        if (!configs) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+        for (i = 0; i < s_n; ++i)
+            for (j = 0; j < E_n; ++j)
+                for (k = 0; k < b_n; ++k) {
+                    configs[n].s = s_values[i];
+                    configs[n].E = E_values[j];
+                    configs[n].b = b_values[k];
+                    ++n;
+                }
+        if (*p == '\0') break;
+        ++p;
+    }
+    *config_num = n;
+    return configs;
+}
+
+static void* sweep_worker(void* arg)
+{
+    sweep_job* job = arg;
+    int i;
+    size_t j;
+
+    while ((i = atomic_fetch_add(&job->next_config, 1)) < job->config_num)
+    {
+        sweep_config* config = &job->configs[i];
+        cache_struct cache;
+        init_cache_or_exit(&cache, config->s, config->E, config->b, job->policy, job->index_fn);
+        for (j = 0; j < job->record_num; ++j)
+            replay_record(&cache, &job->records[j], false);
+        config->hits = cache.hits;
+        config->misses = cache.misses;
+        config->evictions = cache.evictions;
+        free_cache(&cache);
+    }
+    return NULL;
+}
+
+/*
+ * run_sweep - simulate every geometry of `spec` over one decoded trace
+ *  and print a csv or json results table
+ */
+void run_sweep(const char* spec, const char* trace_file_name, bool binary, int policy, int index_fn,
+               int thread_num, bool json)
+{
+    sweep_job job;
+    pthread_t* threads;
+    int i;
+
+    job.configs = parse_sweep_spec(spec, &job.config_num);
+    for (i = 0; i < job.config_num; ++i)
+        if (job.configs[i].s < 0 || job.configs[i].s > MAX_SET_BITS || job.configs[i].E < 1 || job.configs[i].b < 0 ||
+            job.configs[i].s + job.configs[i].b >= 64) {
+            printf("invalid geometry s=%d E=%d b=%d\n", job.configs[i].s, job.configs[i].E, job.configs[i].b);
+            exit(1);
+        }
+    job.records = load_trace_records(trace_file_name, binary, &job.record_num);
+    job.policy = policy;
+    job.index_fn = index_fn;
+    atomic_init(&job.next_config, 0);
+
+    if (thread_num < 1) thread_num = 1;
+    if (thread_num > job.config_num) thread_num = job.config_num;
+    threads = malloc(thread_num * sizeof(pthread_t));
+    for (i = 1; i < thread_num; ++i)
+        if (pthread_create(&threads[i], NULL, sweep_worker, &job) != 0) {
+            printf("failed to create thread!\n");
+            exit(1);
+        }
+    sweep_worker(&job);
+    for (i = 1; i < thread_num; ++i)
+        pthread_join(threads[i], NULL);
+
+    if (json) printf("[\n");
+    else printf("s,E,b,hits,misses,evictions,miss_rate\n");
+    for (i = 0; i < job.config_num; ++i)
+    {
+        sweep_config* config = &job.configs[i];
+        double miss_rate = config->hits + config->misses ? (double) config->misses / (config->hits + config->misses) : 0;
+        if (json)
+            printf("  {\"s\": %d, \"E\": %d, \"b\": %d, \"hits\": %lld, \"misses\": %lld, \"evictions\": %lld, \"miss_rate\": %.6f}%s\n",
+                   config->s, config->E, config->b, config->hits, config->misses, config->evictions, miss_rate,
+                   i + 1 < job.config_num ? "," : "");
+        else
+            printf("%d,%d,%d,%lld,%lld,%lld,%.6f\n",
+                   config->s, config->E, config->b, config->hits, config->misses, config->evictions, miss_rate);
+    }
+    if (json) printf("]\n");
+
+    free(threads);
+    free((void*) job.records);
+    free(job.configs);
+}
+
+/*
+ * parallel replay: sets never interact, so one trace can be split by set.
+ * the parsing thread computes each access's set and tag and appends it to the
+ * ring of the worker owning that set; workers replay their shard on a shallow
+ * copy of the cache (shared line arrays, private counters) and the counters
+ * are summed at the end. every set still sees its accesses in trace order,
+ * so the result is exactly the serial one. shards are groups of sets at least
+ * 64 bytes wide in the per-line arrays (`valid` is the narrowest) and in the
+ * int per-set arrays (`mru`, `lru`, `filled`, `draws`), so workers do not
+ * share cache lines.
+ */
+#define SHARD_RING_SIZE (1 << 16)
+#define SHARD_PUBLISH_BATCH 256
+
+typedef struct {
+    unsigned long long tag;
+    int set_index;
+    int size;
+    char op;
+} shard_item;
+
+typedef struct {
+    shard_item* items;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_bool done;
+    size_t local_head;
+    size_t cached_tail;
+    cache_struct cache;
+    pthread_t thread;
+} shard_ring;
+
+static void* shard_worker(void* arg)
+{
+    shard_ring* ring = arg;
+    size_t tail = 0, head;
+    bool done;
+
+    for (;;) {
+        done = atomic_load_explicit(&ring->done, memory_order_acquire);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == head) {
+            if (done) break;
+            sched_yield();
+            continue;
+        }
+        for (; tail != head; ++tail) {
+            const shard_item* item = &ring->items[tail & (SHARD_RING_SIZE - 1)];
+            switch (item->op) {
+                case 'L':
+                    load_cache(&ring->cache, item->set_index, item->tag, false);
+                    break;
+                case 'S':
+                    store_cache(&ring->cache, item->set_index, item->tag, item->size, false);
+                    break;
+                case 'M':
+                    modify_cache(&ring->cache, item->set_index, item->tag, item->size, false);
+                    break;
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static inline void shard_publish(shard_ring* ring)
+{
+    atomic_store_explicit(&ring->head, ring->local_head, memory_order_release);
+}
+
+static inline void shard_push(shard_ring* ring, const shard_item* item)
+{
+    if (ring->local_head - ring->cached_tail == SHARD_RING_SIZE) {
+        shard_publish(ring);
+        while (ring->local_head - (ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire))
+               == SHARD_RING_SIZE)
+            sched_yield();
+    }
+    ring->items[ring->local_head++ & (SHARD_RING_SIZE - 1)] = *item;
+    if (!(ring->local_head % SHARD_PUBLISH_BATCH)) shard_publish(ring);
+}
+
+/*
+ * replay_parallel - replay the data accesses of `reader` on `thread_num`
+ *  workers, leaving the summed counters in `cache`
+ */
+void replay_parallel(cache_struct* cache, trace_reader* reader, int thread_num)
+{
+    shard_ring* rings = calloc(thread_num, sizeof(shard_ring));
+    trace_record record;
+    shard_item item;
+    int group_shift = 0, i;
+
+    if (!rings) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    while ((cache->line_num << group_shift) < 64 || (sizeof(int) << group_shift) < 64) ++group_shift;
+    for (i = 0; i < thread_num; ++i) {
+        rings[i].items = malloc(SHARD_RING_SIZE * sizeof(shard_item));
+        if (!rings[i].items) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+        atomic_init(&rings[i].head, 0);
+        atomic_init(&rings[i].tail, 0);
+        atomic_init(&rings[i].done, false);
+        rings[i].cache = *cache;
+        if (pthread_create(&rings[i].thread, NULL, shard_worker, &rings[i]) != 0) {
+            printf("failed to create thread!\n");
+            exit(1);
+        }
+    }
+
+    while (next_record(reader, &record))
+    {
+        if (record.op == 'I') continue;
+        item.tag = record.addr >> cache->block_bits;
+        item.set_index = block_set_index(cache, item.tag, cache->index_fn);
+        item.size = record.size;
+        item.op = record.op;
+        shard_push(&rings[(item.set_index >> group_shift) % thread_num], &item);
+    }
+
+    for (i = 0; i < thread_num; ++i) {
+        shard_publish(&rings[i]);
+        atomic_store_explicit(&rings[i].done, true, memory_order_release);
+    }
+    for (i = 0; i < thread_num; ++i) {
+        pthread_join(rings[i].thread, NULL);
+        cache->hits += rings[i].cache.hits;
+        cache->misses += rings[i].cache.misses;
+        cache->evictions += rings[i].cache.evictions;
+        cache->writebacks += rings[i].cache.writebacks;
+        cache->bytes_read += rings[i].cache.bytes_read;
+        cache->bytes_written += rings[i].cache.bytes_written;
+        free(rings[i].items);
+    }
+    free(rings);
+}
+
+/*
+ * stack distance mode: one pass over the trace yields the LRU result for every
+ * associativity up to `E` and every set-index width up to `s`. for each width,
+ * each set keeps a timeline of its accesses in a Fenwick tree holding a 1 at the
+ * latest access time of every block; the stack distance of a reuse is the number
+ * of marks after the block's previous time, and a reference hits in an E-way set
+ * exactly when that distance is below E.
+ */
+#define SD_NO_OWNER UINT_MAX
+
+typedef struct {
+    int capacity;
+    int now;
+    int live;
+    int* tree;
+    unsigned* owner;
+} sd_timeline;
+
+typedef struct {
+    sd_timeline* sets;
+    long long* histogram;
+    long long cold;
+    long long far;
+} sd_width;
+
+typedef struct {
+    int max_s;
+    int max_E;
+    int b;
+    sd_width* widths;
+    addr_map blocks;
+    int* last_time;
+    size_t last_time_capacity;
+    long long references;
+} stack_distance;
+
+static inline void fenwick_add(int* tree, int capacity, int i, int delta)
+{
+    for (; i <= capacity; i += i & -i) tree[i] += delta;
+}
+
+static inline int fenwick_prefix(const int* tree, int i)
+{
+    int sum = 0;
+    for (; i > 0; i -= i & -i) sum += tree[i];
+    return sum;
+}
+
+/*
+ * sd_compact - renumber the live marks of a full timeline to 1..live,
+ *  growing it when more than half of it is live
+ */
+static void sd_compact(stack_distance* sd, int w, sd_timeline* timeline)
+{
+    int t, k = 0, j;
+    int width_num = sd->max_s + 1;
+
+    for (t = 1; t <= timeline->now; ++t)
+        if (timeline->owner[t] != SD_NO_OWNER) {
+            timeline->owner[++k] = timeline->owner[t];
+            sd->last_time[(size_t) timeline->owner[k] * width_num + w] = k;
+        }
+    if (timeline->live * 2 > timeline->capacity) {
+        timeline->capacity *= 2;
+        timeline->tree = realloc(timeline->tree, (timeline->capacity + 1) * sizeof(int));
+        timeline->owner = realloc(timeline->owner, (timeline->capacity + 1) * sizeof(unsigned));
+        if (!timeline->tree || !timeline->owner) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+    }
+    // linear-time Fenwick build over the k leading ones
+    for (t = 1; t <= timeline->capacity; ++t) timeline->tree[t] = t <= k;
+    for (t = 1; t <= timeline->capacity; ++t)
+        if ((j = t + (t & -t)) <= timeline->capacity) timeline->tree[j] += timeline->tree[t];
+    timeline->now = k;
+}
+
+void init_stack_distance(stack_distance* sd, int max_s, int max_E, int b)
+{
+    int w;
+    sd->max_s = max_s;
+    sd->max_E = max_E;
+    sd->b = b;
+    sd->references = 0;
+    sd->widths = malloc((max_s + 1) * sizeof(sd_width));
+    sd->last_time_capacity = 1 << 16;
+    sd->last_time = malloc(sd->last_time_capacity * (max_s + 1) * sizeof(int));
+    if (!sd->widths || !sd->last_time) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    for (w = 0; w <= max_s; ++w) {
+        sd->widths[w].sets = calloc((size_t) 1 << w, sizeof(sd_timeline));
+        sd->widths[w].histogram = calloc(max_E, sizeof(long long));
+        if (!sd->widths[w].sets || !sd->widths[w].histogram) {
+            printf("failed to allocate space!");
+            exit(0);
+        }
+        sd->widths[w].cold = sd->widths[w].far = 0;
+    }
+    addr_map_init(&sd->blocks, 1 << 16);
+}
+
+void free_stack_distance(stack_distance* sd)
+{
+    int w;
+    size_t i;
+    for (w = 0; w <= sd->max_s; ++w) {
+        for (i = 0; i < (size_t) 1 << w; ++i) {
+            free(sd->widths[w].sets[i].tree);
+            free(sd->widths[w].sets[i].owner);
+        }
+        free(sd->widths[w].sets);
+        free(sd->widths[w].histogram);
+    }
+    free(sd->widths);
+    free(sd->last_time);
+    addr_map_free(&sd->blocks);
+}
+
+/*
+ * sd_access - record one reference to `block` at every set-index width
+ */
+void sd_access(stack_distance* sd, unsigned long long block)
+{
+    int width_num = sd->max_s + 1;
+    bool inserted;
+    unsigned id = addr_map_get(&sd->blocks, block, &inserted);
+    int w;
+
+    if (inserted) {
+        if (id == sd->last_time_capacity) {
+            sd->last_time_capacity *= 2;
+            sd->last_time = realloc(sd->last_time, sd->last_time_capacity * width_num * sizeof(int));
+            if (!sd->last_time) {
+                printf("failed to allocate space!");
+                exit(0);
+            }
+        }
+        memset(sd->last_time + (size_t) id * width_num, 0, width_num * sizeof(int));
+    }
+    ++sd->references;
+
+    for (w = 0; w < width_num; ++w)
+    {
+        sd_width* width = &sd->widths[w];
+        sd_timeline* timeline = &width->sets[block & (((unsigned long long) 1 << w) - 1)];
+        int* last = &sd->last_time[(size_t) id * width_num + w];
+
+        if (*last == 0) ++width->cold;
+        else {
+            int distance = timeline->live - fenwick_prefix(timeline->tree, *last);
+            if (distance < sd->max_E) ++width->histogram[distance];
+            else ++width->far;
+            fenwick_add(timeline->tree, timeline->capacity, *last, -1);
+            timeline->owner[*last] = SD_NO_OWNER;
+            --timeline->live;
+        }
+
+        if (!timeline->tree) {
+            timeline->capacity = 4;
+            timeline->tree = calloc(timeline->capacity + 1, sizeof(int));
+            timeline->owner = malloc((timeline->capacity + 1) * sizeof(unsigned));
+            if (!timeline->tree || !timeline->owner) {
+                printf("failed to allocate space!");
+                exit(0);
+            }
+        }
+        else if (timeline->now == timeline->capacity) sd_compact(sd, w, timeline);
+        *last = ++timeline->now;
+        timeline->owner[*last] = id;
+        fenwick_add(timeline->tree, timeline->capacity, *last, 1);
+        ++timeline->live;
+    }
+}
+
+/*
+ * run_stack_distance - print the LRU hits/misses/evictions of every
+ *  (s', E') with s' <= s and E' <= E from a single pass over the trace
+ */
+void run_stack_distance(const char* trace_file_name, bool binary, int s, int E, int b, bool json)
+{
+    stack_distance sd;
+    trace_reader reader;
+    trace_record record;
+    int w, e;
+    bool first = true;
+
+    init_stack_distance(&sd, s, E, b);
+    open_trace(&reader, trace_file_name, binary);
+    while (next_record(&reader, &record))
+    {
+        if (record.op == 'I') continue;
+        sd_access(&sd, record.addr >> b);
+        if (record.op == 'M') sd_access(&sd, record.addr >> b);
+    }
+    close_trace(&reader);
+
+    if (json) printf("[\n");
+    else printf("s,E,b,hits,misses,evictions,miss_rate\n");
+    for (w = 0; w <= s; ++w)
+    {
+        sd_width* width = &sd.widths[w];
+        long long misses = sd.references - width->cold;
+        size_t set_num = (size_t) 1 << w, i;
+        for (e = 1; e <= E; ++e)
+        {
+            // every set fills min(E, distinct blocks) empty lines, other misses evict
+            long long fills = 0, evictions;
+            double miss_rate;
+            misses -= width->histogram[e - 1];
+            for (i = 0; i < set_num; ++i)
+                fills += width->sets[i].live < e ? width->sets[i].live : e;
+            evictions = misses + width->cold - fills;
+            miss_rate = sd.references ? (double) (misses + width->cold) / sd.references : 0;
+            if (json) {
+                printf("%s  {\"s\": %d, \"E\": %d, \"b\": %d, \"hits\": %lld, \"misses\": %lld, \"evictions\": %lld, \"miss_rate\": %.6f}",
+                       first ? "" : ",\n", w, e, b, sd.references - misses - width->cold, misses + width->cold, evictions, miss_rate);
+                first = false;
+            }
+            else
+                printf("%d,%d,%d,%lld,%lld,%lld,%.6f\n",
+                       w, e, b, sd.references - misses - width->cold, misses + width->cold, evictions, miss_rate);
+        }
+    }
+    if (json) printf("\n]\n");
+    free_stack_distance(&sd);
+}
+
+/*
+ * multi-level mode: L1I and L1D in front of an optional L2 and LLC, all with
+ * the same block size, write-back and write-allocate. L1I takes the `I`
+ * records, L1D the data accesses. a level's next level is the first present
+ * level below it, then memory.
+ *  - nine: a miss fills every level on the way, evictions are not propagated
+ *  - inclusive: like nine, but a level evicting a block also invalidates it
+ *      in the levels above (a dirty upper copy makes the victim dirty)
+ *  - exclusive: a block lives in one level only; misses fill L1 only, a hit
+ *      below moves the block up, and every L1/L2 victim (clean or dirty) is
+ *      inserted into the next level
+ */
+enum {
+    LEVEL_L1I,
+    LEVEL_L1D,
+    LEVEL_L2,
+    LEVEL_LLC,
+    LEVEL_NUM,
+    LEVEL_MEMORY = LEVEL_NUM
+};
+
+enum {
+    INCLUSION_NINE,
+    INCLUSION_INCLUSIVE,
+    INCLUSION_EXCLUSIVE,
+    INCLUSION_NUM
+};
+
+static const char* level_names[LEVEL_NUM] = {"L1I", "L1D", "L2", "LLC"};
+static const char* inclusion_names[INCLUSION_NUM] = {"nine", "inclusive", "exclusive"};
+
+typedef struct {
+    int s;
+    int E;
+} level_geometry;
+
+typedef struct {
+    cache_struct levels[LEVEL_NUM];
+    bool present[LEVEL_NUM];
+    int inclusion;
+    long long back_invalidations;
+    long long memory_reads;
+    long long memory_writes;
+} hierarchy;
+
+static int next_level(hierarchy* h, int level)
+{
+    int lower = level < LEVEL_L2 ? LEVEL_L2 : level + 1;
+    while (lower < LEVEL_NUM && !h->present[lower]) ++lower;
+    return lower;
+}
+
+void init_hierarchy(hierarchy* h, const level_geometry* geometry, int b, int policy, int index_fn, int inclusion)
+{
+    int level;
+    h->inclusion = inclusion;
+    h->back_invalidations = h->memory_reads = h->memory_writes = 0;
+    for (level = 0; level < LEVEL_NUM; ++level) {
+        h->present[level] = geometry[level].E > 0;
+        if (h->present[level])
+            init_cache_or_exit(&h->levels[level], geometry[level].s, geometry[level].E, b, policy, index_fn);
+    }
+}
+
+void free_hierarchy(hierarchy* h)
+{
+    int level;
+    for (level = 0; level < LEVEL_NUM; ++level)
+        if (h->present[level]) free_cache(&h->levels[level]);
+}
+
+static void write_block(hierarchy* h, int level, unsigned long long block);
+
+/*
+ * evict_to - hand a victim of the level above `level` down to `level`
+ */
+static void evict_to(hierarchy* h, int level, int from, unsigned long long block, bool dirty)
+{
+    int upper, state;
+    if (h->inclusion == INCLUSION_INCLUSIVE && from >= LEVEL_L2) {
+        for (upper = LEVEL_L1I; upper < from; ++upper)
+            if (h->present[upper] && (state = invalidate_block(&h->levels[upper], block)) >= 0) {
+                ++h->back_invalidations;
+                dirty |= state;
+            }
+    }
+    if (h->inclusion == INCLUSION_EXCLUSIVE) {
+        unsigned long long victim;
+        bool victim_dirty;
+        if (level == LEVEL_MEMORY) {
+            if (dirty) ++h->memory_writes;
+        }
+        else if (insert_block(&h->levels[level], block, dirty, &victim, &victim_dirty))
+            evict_to(h, next_level(h, level), level, victim, victim_dirty);
+    }
+    else if (dirty) write_block(h, level, block);
+}
+
+/*
+ * write_block - write back a dirty block into `level`
+ *  a writeback that misses allocates the block without fetching it
+ */
+static void write_block(hierarchy* h, int level, unsigned long long block)
+{
+    long line;
+    unsigned long long victim;
+    bool victim_dirty;
+
+    if (level == LEVEL_MEMORY) {
+        ++h->memory_writes;
+        return;
+    }
+    if ((line = lookup_block(&h->levels[level], block)) >= 0) {
+        h->levels[level].dirty[line] = true;
+        return;
+    }
+    if (insert_block(&h->levels[level], block, true, &victim, &victim_dirty))
+        evict_to(h, next_level(h, level), level, victim, victim_dirty);
+}
+
+/*
+ * fetch_block - demand access to `block` at `level`
+ *  returns the dirty bit the block arrives with (exclusive mode moves dirty
+ *  blocks up), the caller sets it when the access is a store
+ */
+static bool fetch_block(hierarchy* h, int level, unsigned long long block, bool is_write)
+{
+    cache_struct* cache;
+    long line;
+    unsigned long long victim;
+    bool victim_dirty, dirty = false;
+    int lower, state;
+
+    if (level == LEVEL_MEMORY) {
+        ++h->memory_reads;
+        return false;
+    }
+    cache = &h->levels[level];
+    if ((line = lookup_block(cache, block)) >= 0) {
+        ++cache->hits;
+        if (h->inclusion == INCLUSION_EXCLUSIVE && level >= LEVEL_L2) {
+            // the block moves up, the caller re-inserts it
+            state = invalidate_block(cache, block);
+            return state;
+        }
+        touch_block(cache, line);
+        if (is_write) cache->dirty[line] = true;
+        return cache->dirty[line];
+    }
+
+    ++cache->misses;
+    lower = next_level(h, level);
+    if (h->inclusion == INCLUSION_EXCLUSIVE && level >= LEVEL_L2) {
+        // below L1 an exclusive level only forwards the miss
+        return fetch_block(h, lower, block, false);
+    }
+    dirty = fetch_block(h, lower, block, false);
+    if (h->inclusion != INCLUSION_EXCLUSIVE) dirty = false;
+    if (insert_block(cache, block, dirty || is_write, &victim, &victim_dirty))
+        evict_to(h, lower, level, victim, victim_dirty);
+    return dirty || is_write;
+}
 
-void init_cache(cache_struct* cache, int s, int E)
+void hierarchy_access(hierarchy* h, const trace_record* record)
 {
-    int i, j;
-    cache -> set_num = 1 << s;
-    cache -> line_num = E;
-    cache->sets = (set*) malloc(cache->set_num * sizeof(set));
-    if (!cache->sets) {
-        printf("failed to allocate space!");
-        exit(0);
+    unsigned long long block = record->addr >> h->levels[h->present[LEVEL_L1D] ? LEVEL_L1D : LEVEL_L1I].block_bits;
+    switch (record->op) {
+        case 'I':
+            if (h->present[LEVEL_L1I]) fetch_block(h, LEVEL_L1I, block, false);
+            break;
+        case 'L':
+            fetch_block(h, LEVEL_L1D, block, false);
+            break;
+        case 'S':
+            fetch_block(h, LEVEL_L1D, block, true);
+            break;
+        case 'M':
+            fetch_block(h, LEVEL_L1D, block, false);
+            fetch_block(h, LEVEL_L1D, block, true);
+            break;
     }
-    for (i = 0; i < cache->set_num; ++i)
-    {
-        cache->sets[i].lines = (line*) malloc(cache->line_num * sizeof(line));
-        if (!cache->sets[i].lines) {
+}
+
+/*
+ * parse_level_geometry - parse an "s:E" level spec
+ */
+void parse_level_geometry(const char* spec, level_geometry* geometry)
+{
+    if (sscanf(spec, "%d:%d", &geometry->s, &geometry->E) != 2 || geometry->s < 0 || geometry->s > MAX_SET_BITS
+        || geometry->E < 1) {
+        printf("invalid level geometry: %s\n", spec);
+        exit(1);
+    }
+}
+
+void run_hierarchy(const char* trace_file_name, bool binary, const level_geometry* geometry, int b, int policy,
+                   int index_fn, int inclusion)
+{
+    hierarchy h;
+    trace_reader reader;
+    trace_record record;
+    int level;
+
+    init_hierarchy(&h, geometry, b, policy, index_fn, inclusion);
+    open_trace(&reader, trace_file_name, binary);
+    while (next_record(&reader, &record))
+        hierarchy_access(&h, &record);
+    close_trace(&reader);
+
+    printf("%-5s %12s %12s %12s %12s\n", "level", "hits", "misses", "evictions", "writebacks");
+    for (level = 0; level < LEVEL_NUM; ++level)
+        if (h.present[level])
+            printf("%-5s %12lld %12lld %12lld %12lld\n", level_names[level], h.levels[level].hits,
+                   h.levels[level].misses, h.levels[level].evictions, h.levels[level].writebacks);
+    printf("inclusion: %s, back-invalidations: %lld\n", inclusion_names[inclusion], h.back_invalidations);
+    printf("memory reads: %lld (%lld bytes), writes: %lld (%lld bytes)\n",
+           h.memory_reads, h.memory_reads << b, h.memory_writes, h.memory_writes << b);
+    free_hierarchy(&h);
+}
+
+/*
+ * coherent multi-core mode: every core of a core-tagged trace gets a private
+ * cache (a cache_struct with -s/-E or --l1d) kept coherent by snooping the
+ * other cores, in front of one shared, non-inclusive LLC (--llc, four times
+ * the private cache by default).
+ *  - MESI: a remote read of a Modified line writes it back to the LLC and
+ *      leaves both copies Shared
+ *  - MOESI: the owner keeps the dirty line as Owned and supplies it, so
+ *      sharing a dirty line costs no writeback
+ *  a read miss becomes Exclusive if no other core holds the line, a write
+ *  invalidates every other copy. a miss on a line this core lost to an
+ *  invalidation is a coherence miss. ping-pongs count the invalidations and
+ *  ownership downgrades each line suffers, the false sharing hot spots.
+ *  per line state lives beside each private cache's arrays; per block
+ *  counters hang off an addr_map id.
+ */
+#define MAX_CORES 64
+
+enum {
+    COHERENCE_MESI,
+    COHERENCE_MOESI,
+    COHERENCE_NUM
+};
+
+static const char* coherence_names[COHERENCE_NUM] = {"mesi", "moesi"};
+
+enum {
+    STATE_I,
+    STATE_S,
+    STATE_E,
+    STATE_O,
+    STATE_M
+};
+
+typedef struct {
+    int core_num;
+    int protocol;
+    cache_struct cores[MAX_CORES];
+    unsigned char* states[MAX_CORES];
+    long long coherence_misses[MAX_CORES];
+    cache_struct llc;
+    addr_map blocks;
+    unsigned long long* invalidated;
+    long long* accesses;
+    long long* ping_pongs;
+    size_t block_capacity;
+    long long invalidations;
+    long long upgrades;
+    long long transfers;
+    long long memory_reads;
+    long long memory_writes;
+} coherent_system;
+
+void init_coherent(coherent_system* sys, int core_num, int protocol, const level_geometry* core_geometry,
+                   const level_geometry* llc_geometry, int b, int policy, int index_fn)
+{
+    int core;
+    memset(sys, 0, sizeof(coherent_system));
+    sys->core_num = core_num;
+    sys->protocol = protocol;
+    for (core = 0; core < core_num; ++core) {
+        init_cache_or_exit(&sys->cores[core], core_geometry->s, core_geometry->E, b, policy, index_fn);
+        sys->states[core] = calloc((size_t) sys->cores[core].set_num * sys->cores[core].line_num, 1);
+        if (!sys->states[core]) {
             printf("failed to allocate space!");
             exit(0);
         }
-        for (j = 0; j < cache->line_num; ++j)
-        {
-            cache->sets[i].lines[j].valid = false;
-            cache->sets[i].lines[j].tag = 0;
-            cache->sets[i].lines[j].lru_mark = UINT_MAX;
+    }
+    init_cache_or_exit(&sys->llc, llc_geometry->s, llc_geometry->E, b, policy, index_fn);
+    addr_map_init(&sys->blocks, 1 << 12);
+    sys->block_capacity = 1 << 12;
+    sys->invalidated = malloc(sys->block_capacity * sizeof(unsigned long long));
+    sys->accesses = malloc(sys->block_capacity * sizeof(long long));
+    sys->ping_pongs = malloc(sys->block_capacity * sizeof(long long));
+    if (!sys->invalidated || !sys->accesses || !sys->ping_pongs) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+}
+
+void free_coherent(coherent_system* sys)
+{
+    int core;
+    for (core = 0; core < sys->core_num; ++core) {
+        free_cache(&sys->cores[core]);
+        free(sys->states[core]);
+    }
+    free_cache(&sys->llc);
+    addr_map_free(&sys->blocks);
+    free(sys->invalidated);
+    free(sys->accesses);
+    free(sys->ping_pongs);
+}
+
+static unsigned block_id(coherent_system* sys, unsigned long long block)
+{
+    bool inserted;
+    unsigned id = addr_map_get(&sys->blocks, block, &inserted);
+    if (inserted) {
+        if (id == sys->block_capacity) {
+            sys->block_capacity *= 2;
+            sys->invalidated = realloc(sys->invalidated, sys->block_capacity * sizeof(unsigned long long));
+            sys->accesses = realloc(sys->accesses, sys->block_capacity * sizeof(long long));
+            sys->ping_pongs = realloc(sys->ping_pongs, sys->block_capacity * sizeof(long long));
+            if (!sys->invalidated || !sys->accesses || !sys->ping_pongs) {
+                printf("failed to allocate space!");
+                exit(0);
+            }
         }
+        sys->invalidated[id] = 0;
+        sys->accesses[id] = sys->ping_pongs[id] = 0;
     }
+    return id;
 }
 
-void update_lru(cache_struct* cache, int set_index, int line_index)
+/*
+ * llc_write - write a dirty block back from a private cache
+ */
+static void llc_write(coherent_system* sys, unsigned long long block)
 {
-    int i = 0;
-    cache->sets[set_index].lines[line_index].lru_mark = UINT_MAX;
-    for (i = 0; i < cache->line_num; ++i)
-        if (i != line_index) --cache->sets[set_index].lines[i].lru_mark;
+    unsigned long long victim;
+    bool victim_dirty;
+    long line = lookup_block(&sys->llc, block);
+    if (line >= 0) {
+        touch_block(&sys->llc, line);
+        sys->llc.dirty[line] = true;
+    }
+    else if (insert_block(&sys->llc, block, true, &victim, &victim_dirty) && victim_dirty)
+        ++sys->memory_writes;
 }
 
-bool update_line(cache_struct* cache, int set_index, unsigned tag)
+/*
+ * llc_read - fetch a block no private cache could supply
+ */
+static void llc_read(coherent_system* sys, unsigned long long block)
 {
-    bool is_full = true;
-    int i;
-    for (i = 0; i < cache->line_num; ++i)
-        if (!cache->sets[set_index].lines[i].valid)
-        {
-            is_full = false;
-            break;
+    unsigned long long victim;
+    bool victim_dirty;
+    long line = lookup_block(&sys->llc, block);
+    if (line >= 0) {
+        ++sys->llc.hits;
+        touch_block(&sys->llc, line);
+        return;
+    }
+    ++sys->llc.misses;
+    ++sys->memory_reads;
+    if (insert_block(&sys->llc, block, false, &victim, &victim_dirty) && victim_dirty) ++sys->memory_writes;
+}
+
+/*
+ * fill_core - bring `block` into `core` in `state`, writing back a dirty victim
+ */
+static void fill_core(coherent_system* sys, int core, unsigned long long block, int state)
+{
+    cache_struct* cache = &sys->cores[core];
+    unsigned long long victim;
+    bool victim_dirty;
+    if (insert_block(cache, block, state == STATE_M || state == STATE_O, &victim, &victim_dirty) && victim_dirty) {
+        cache->bytes_written += 1LL << cache->block_bits;
+        llc_write(sys, victim);
+    }
+    sys->states[core][lookup_block(cache, block)] = state;
+}
+
+/*
+ * coherent_access - one load or store of `core`
+ */
+static void coherent_access(coherent_system* sys, int core, unsigned long long block, bool is_write)
+{
+    cache_struct* cache = &sys->cores[core];
+    unsigned id = block_id(sys, block);
+    long line = lookup_block(cache, block), remote;
+    bool shared = false, supplied = false;
+    int other, state;
+
+    ++sys->accesses[id];
+    if (line >= 0) {
+        ++cache->hits;
+        touch_block(cache, line);
+        state = sys->states[core][line];
+        if (!is_write || state == STATE_M) return;
+        if (state == STATE_E) {
+            sys->states[core][line] = STATE_M;
+            cache->dirty[line] = true;
+            return;
         }
-    if (is_full)
-    {
-        int min_lru_index = 0;
-        unsigned min_lru_mark = UINT_MAX;
-        for (i = 0; i < cache->line_num; ++i)
-            if (cache->sets[set_index].lines[i].lru_mark < min_lru_mark) {
-                min_lru_index = i;
-                min_lru_mark = cache->sets[set_index].lines[i].lru_mark;
+        // a store to a Shared or Owned line upgrades it by invalidating the other copies
+        ++sys->upgrades;
+    }
+    else {
+        ++cache->misses;
+        if (sys->invalidated[id] >> core & 1) ++sys->coherence_misses[core];
+        sys->invalidated[id] &= ~(1ULL << core);
+    }
+
+    for (other = 0; other < sys->core_num; ++other) {
+        if (other == core || (remote = lookup_block(&sys->cores[other], block)) < 0) continue;
+        state = sys->states[other][remote];
+        if (state == STATE_M || state == STATE_O) supplied = true;
+        if (is_write) {
+            invalidate_block(&sys->cores[other], block);
+            sys->states[other][remote] = STATE_I;
+            sys->invalidated[id] |= 1ULL << other;
+            ++sys->invalidations;
+            ++sys->ping_pongs[id];
+            continue;
+        }
+        shared = true;
+        if (state == STATE_E || state == STATE_M) {
+            ++sys->ping_pongs[id];
+            if (state == STATE_M && sys->protocol == COHERENCE_MESI) {
+                llc_write(sys, block);
+                sys->cores[other].dirty[remote] = false;
+                sys->states[other][remote] = STATE_S;
             }
-        cache->sets[set_index].lines[min_lru_index].valid = true;
-        cache->sets[set_index].lines[min_lru_index].tag = tag;
-        update_lru(cache, set_index, min_lru_index);
-        return true;
+            else sys->states[other][remote] = state == STATE_M ? STATE_O : STATE_S;
+        }
     }
-    else
-    {
-        cache->sets[set_index].lines[i].valid = true;
-        cache->sets[set_index].lines[i].tag = tag;
-        update_lru(cache, set_index, i);
+
+    if (line >= 0) {
+        sys->states[core][line] = STATE_M;
+        cache->dirty[line] = true;
+        return;
+    }
+    if (supplied) ++sys->transfers;
+    else llc_read(sys, block);
+    fill_core(sys, core, block, is_write ? STATE_M : shared ? STATE_S : STATE_E);
+}
+
+void run_coherent(const char* trace_file_name, bool binary, int core_num, int protocol,
+                  const level_geometry* core_geometry, const level_geometry* llc_geometry, int b, int policy,
+                  int index_fn, int top)
+{
+    coherent_system sys;
+    trace_reader reader;
+    trace_record record;
+    unsigned long long* keys;
+    long long hits = 0, misses = 0, evictions = 0;
+    size_t i;
+    int core;
+
+    init_coherent(&sys, core_num, protocol, core_geometry, llc_geometry, b, policy, index_fn);
+    open_trace(&reader, trace_file_name, binary);
+    while (next_record(&reader, &record)) {
+        unsigned long long block = record.addr >> b;
+        if (record.op == 'I') continue;
+        if (record.core >= core_num) {
+            printf("core id %d out of range!\n", record.core);
+            exit(1);
+        }
+        if (record.op != 'S') coherent_access(&sys, record.core, block, false);
+        if (record.op != 'L') coherent_access(&sys, record.core, block, true);
+    }
+    close_trace(&reader);
+
+    printf("%-5s %12s %12s %12s %12s %12s\n", "core", "hits", "misses", "evictions", "writebacks", "coherence");
+    for (core = 0; core < core_num; ++core) {
+        cache_struct* cache = &sys.cores[core];
+        printf("%-5d %12lld %12lld %12lld %12lld %12lld\n", core, cache->hits, cache->misses, cache->evictions,
+               cache->writebacks, sys.coherence_misses[core]);
+        hits += cache->hits;
+        misses += cache->misses;
+        evictions += cache->evictions;
+    }
+    printSummary(hits, misses, evictions);
+    printf("protocol: %s, invalidations: %lld, upgrades: %lld, cache-to-cache transfers: %lld\n",
+           coherence_names[protocol], sys.invalidations, sys.upgrades, sys.transfers);
+    printf("llc hits: %lld, misses: %lld, evictions: %lld\n", sys.llc.hits, sys.llc.misses, sys.llc.evictions);
+    printf("memory reads: %lld (%lld bytes), writes: %lld (%lld bytes)\n",
+           sys.memory_reads, sys.memory_reads << b, sys.memory_writes, sys.memory_writes << b);
+
+    keys = malloc((sys.blocks.size + 1) * sizeof(unsigned long long));
+    if (!keys) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    for (i = 0; i < sys.blocks.capacity; ++i)
+        if (sys.blocks.ids[i]) keys[sys.blocks.ids[i] - 1] = sys.blocks.keys[i] << b;
+    print_top("lines", "%#18llx", "ping-pongs", keys, sys.accesses, sys.ping_pongs, sys.blocks.size, top);
+    free(keys);
+    free_coherent(&sys);
+}
+
+/*
+ * data TLB model in front of the single level cache: an L1 and an L2 TLB are
+ * cache_structs whose blocks are pages (block bits = page bits, the tag is
+ * the virtual page number), all pages of the run having one size. an L2 miss
+ * walks an x86-64 style four level page table (the leaf is level 1 for 4KB
+ * pages, 2 for 2MB, 3 for 1GB). a page-walk cache per non-leaf level holds
+ * recently used upper entries, so a walk starts below the deepest level it
+ * hits. every entry the walk reads is a load fed into the data cache.
+ * the tables live at synthetic physical addresses above any user address:
+ * the level `k` entry of `va` sits at PT_BASE + (k << 44) + (va >> shift) * 8,
+ * which lays out one 4KB table per parent entry.
+ */
+#define PT_LEVELS 4
+#define PT_BASE 0xffff800000000000ULL
+
+static int pt_shift(int level)
+{
+    return 12 + 9 * (level - 1);
+}
+
+typedef struct {
+    int page_bits;
+    int leaf_level;
+    cache_struct l1;
+    cache_struct l2;
+    cache_struct pwc[PT_LEVELS + 1];
+    long long walks;
+    long long walk_accesses;
+    long long walk_misses;
+    long long instructions;
+} tlb_model;
+
+void init_tlb(tlb_model* tlb, int page_bits, const level_geometry* l1, const level_geometry* l2, int pwc_entries)
+{
+    int level;
+    memset(tlb, 0, sizeof(tlb_model));
+    tlb->page_bits = page_bits;
+    tlb->leaf_level = (page_bits - 12) / 9 + 1;
+    init_cache_or_exit(&tlb->l1, l1->s, l1->E, page_bits, POLICY_LRU, INDEX_MOD);
+    init_cache_or_exit(&tlb->l2, l2->s, l2->E, page_bits, POLICY_LRU, INDEX_MOD);
+    for (level = tlb->leaf_level + 1; level <= PT_LEVELS; ++level)
+        init_cache_or_exit(&tlb->pwc[level], 0, pwc_entries, 0, POLICY_LRU, INDEX_MOD);
+}
+
+void free_tlb(tlb_model* tlb)
+{
+    int level;
+    free_cache(&tlb->l1);
+    free_cache(&tlb->l2);
+    for (level = tlb->leaf_level + 1; level <= PT_LEVELS; ++level) free_cache(&tlb->pwc[level]);
+}
+
+/*
+ * tlb_lookup - probe one TLB level (or page-walk cache) for `key`, counting
+ * the hit or miss
+ */
+static bool tlb_lookup(cache_struct* tlb, unsigned long long key)
+{
+    long line = lookup_block(tlb, key);
+    if (line < 0) {
+        ++tlb->misses;
         return false;
     }
+    ++tlb->hits;
+    touch_block(tlb, line);
+    return true;
 }
 
-void load_cache(cache_struct* cache, int set_index, unsigned tag, bool verbose)
+static void tlb_fill(cache_struct* tlb, unsigned long long key)
 {
-    int i;
-    bool found_data = false;
-    for (i = 0; i<cache->line_num; ++i)
-        if (cache->sets[set_index].lines[i].valid && cache->sets[set_index].lines[i].tag == tag) {
-            found_data = true;
-            update_lru(cache, set_index, i);
-            ++hits;
-            if (verbose) printf("hit ");
+    unsigned long long victim;
+    bool victim_dirty;
+    insert_block(tlb, key, false, &victim, &victim_dirty);
+}
+
+/*
+ * tlb_translate - translate the page of `addr` before `cache` sees the access
+ */
+void tlb_translate(tlb_model* tlb, cache_struct* cache, unsigned long long addr)
+{
+    unsigned long long vpn = addr >> tlb->page_bits;
+    int level, start = PT_LEVELS;
+
+    if (tlb_lookup(&tlb->l1, vpn)) return;
+    if (!tlb_lookup(&tlb->l2, vpn)) {
+        ++tlb->walks;
+        for (level = tlb->leaf_level + 1; level <= PT_LEVELS; ++level)
+            if (tlb_lookup(&tlb->pwc[level], addr >> pt_shift(level))) {
+                start = level - 1;
+                break;
+            }
+        for (level = start; level >= tlb->leaf_level; --level) {
+            trace_record record = {'L', PT_BASE + ((unsigned long long) level << 44) + (addr >> pt_shift(level)) * 8,
+                                   8, 0};
+            long long misses = cache->misses;
+            replay_record(cache, &record, false);
+            tlb->walk_misses += cache->misses - misses;
+            ++tlb->walk_accesses;
+            if (level > tlb->leaf_level) tlb_fill(&tlb->pwc[level], addr >> pt_shift(level));
+        }
+        tlb_fill(&tlb->l2, vpn);
+    }
+    tlb_fill(&tlb->l1, vpn);
+}
+
+void print_tlb_stats(const tlb_model* tlb, const cache_struct* cache)
+{
+    long long pwc_hits = 0, pwc_misses = 0;
+    double kilo_inst = tlb->instructions / 1000.0;
+    int level;
+
+    for (level = tlb->leaf_level + 1; level <= PT_LEVELS; ++level) {
+        pwc_hits += tlb->pwc[level].hits;
+        pwc_misses += tlb->pwc[level].misses;
+    }
+    printf("tlb page:%lldKB l1 hits:%lld misses:%lld l2 hits:%lld misses:%lld\n", (1LL << tlb->page_bits) >> 10,
+           tlb->l1.hits, tlb->l1.misses, tlb->l2.hits, tlb->l2.misses);
+    printf("page walks:%lld walk accesses:%lld walk cache misses:%lld pwc hits:%lld misses:%lld\n", tlb->walks,
+           tlb->walk_accesses, tlb->walk_misses, pwc_hits, pwc_misses);
+    if (tlb->instructions)
+        printf("instructions:%lld l1 tlb mpki:%.3f l2 tlb mpki:%.3f cache mpki:%.3f cache miss rate:%.4f\n",
+               tlb->instructions, tlb->l1.misses / kilo_inst, tlb->l2.misses / kilo_inst, cache->misses / kilo_inst,
+               (double) cache->misses / (cache->hits + cache->misses));
+    else
+        printf("instructions:0 (no I records, mpki unavailable) cache miss rate:%.4f\n",
+               (double) cache->misses / (cache->hits + cache->misses));
+}
+
+#endif
+
+/*
+ * library interface, declared in csim.h. a handle wraps one cache_struct and
+ * everything the simulator touches hangs off it, so handles are independent.
+ */
+struct csim_cache {
+    cache_struct cache;
+};
+
+csim_cache* csim_create(int s, int E, int b, const char* policy, const char* index)
+{
+    csim_cache* handle;
+    int policy_id = POLICY_LRU, index_fn = INDEX_MOD;
+
+    if (s < 0 || s > MAX_SET_BITS || E < 1 || b < 0 || b > 63) return NULL;
+    if (policy) {
+        for (policy_id = 0; policy_id < POLICY_NUM && strcmp(policy, policy_names[policy_id]) != 0; ++policy_id);
+        if (policy_id == POLICY_NUM) return NULL;
+    }
+    if (index) {
+        for (index_fn = 0; index_fn < INDEX_NUM && strcmp(index, index_names[index_fn]) != 0; ++index_fn);
+        if (index_fn == INDEX_NUM) return NULL;
+    }
+    if (policy_id == POLICY_PLRU && (E & (E - 1))) return NULL;
+
+    handle = malloc(sizeof(csim_cache));
+    if (!handle) return NULL;
+    if (init_cache(&handle->cache, s, E, b, policy_id, index_fn) != CACHE_OK) {
+        free(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+void csim_destroy(csim_cache* handle)
+{
+    if (!handle) return;
+    free_cache(&handle->cache);
+    free(handle);
+}
+
+void csim_set_write_policy(csim_cache* handle, bool write_through, bool write_allocate)
+{
+    handle->cache.write_through = write_through;
+    handle->cache.write_allocate = write_allocate;
+}
+
+void csim_access(csim_cache* handle, unsigned long long addr, char op, int size)
+{
+    trace_record record = {op, addr, size, 0};
+    replay_record(&handle->cache, &record, false);
+}
+
+static ALWAYS_INLINE void access_batch(cache_struct* cache, const unsigned long long* addrs, const char* ops,
+                                       const int* sizes, size_t n, const int policy, const int index_fn)
+{
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        unsigned long long tag = addrs[i] >> cache->block_bits;
+        int set_index = block_set_index(cache, tag, index_fn);
+        if (ops[i] == CSIM_LOAD || ops[i] == CSIM_MODIFY)
+            access_line(cache, set_index, tag, false, 0, false, policy);
+        if (ops[i] == CSIM_STORE || ops[i] == CSIM_MODIFY)
+            access_line(cache, set_index, tag, true, sizes ? sizes[i] : 8, false, policy);
+    }
+}
+
+static ALWAYS_INLINE void access_batch_policy(cache_struct* cache, const unsigned long long* addrs, const char* ops,
+                                              const int* sizes, size_t n, const int policy)
+{
+    switch (cache->index_fn) {
+        case INDEX_MOD:
+            access_batch(cache, addrs, ops, sizes, n, policy, INDEX_MOD);
+            break;
+        case INDEX_XOR:
+            access_batch(cache, addrs, ops, sizes, n, policy, INDEX_XOR);
+            break;
+        case INDEX_HASH:
+            access_batch(cache, addrs, ops, sizes, n, policy, INDEX_HASH);
+            break;
+    }
+}
+
+void csim_access_many(csim_cache* handle, const unsigned long long* addrs, const char* ops, const int* sizes,
+                      size_t n)
+{
+    cache_struct* cache = &handle->cache;
+    switch (cache->policy) {
+        case POLICY_LRU:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_LRU);
+            break;
+        case POLICY_FIFO:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_FIFO);
+            break;
+        case POLICY_RANDOM:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_RANDOM);
             break;
+        case POLICY_PLRU:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_PLRU);
+            break;
+        case POLICY_SRRIP:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_SRRIP);
+            break;
+        case POLICY_LFU:
+            access_batch_policy(cache, addrs, ops, sizes, n, POLICY_LFU);
+            break;
+    }
+}
+
+void csim_get_stats(const csim_cache* handle, csim_stats* stats)
+{
+    stats->hits = handle->cache.hits;
+    stats->misses = handle->cache.misses;
+    stats->evictions = handle->cache.evictions;
+    stats->writebacks = handle->cache.writebacks;
+    stats->bytes_read = handle->cache.bytes_read;
+    stats->bytes_written = handle->cache.bytes_written;
+}
+
+void csim_reset_stats(csim_cache* handle)
+{
+    cache_struct* cache = &handle->cache;
+    cache->hits = cache->misses = cache->evictions = cache->writebacks = 0;
+    cache->bytes_read = cache->bytes_written = 0;
+}
+
+#ifndef CSIM_NO_MAIN
+static double elapsed_seconds(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/*
+ * bench_probe - time every available set probe on E = 8, 16 and 32
+ *  each set is filled with distinct tags, half of the lookups hit
+ */
+void bench_probe()
+{
+    static const int ways[] = {8, 16, 32};
+    const int set_bits = 10, lookups = 1 << 24;
+    struct {
+        const char* name;
+        probe_func probe;
+    } probes[3];
+    int probe_count = 0;
+    unsigned long long* keys = malloc(lookups * sizeof(unsigned long long));
+    int* set_indices = malloc(lookups * sizeof(int));
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+    int i, j, k;
+
+    probes[probe_count].name = "scalar";
+    probes[probe_count++].probe = probe_scalar;
+#ifdef CSIM_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        probes[probe_count].name = "sse4.1";
+        probes[probe_count++].probe = probe_sse41;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        probes[probe_count].name = "avx2";
+        probes[probe_count++].probe = probe_avx2;
+    }
+#endif
+    if (!keys || !set_indices) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+
+    printf("%-8s %4s %12s %9s\n", "probe", "E", "Mlookups/s", "speedup");
+    for (i = 0; i < 3; ++i)
+    {
+        cache_struct cache;
+        size_t line_total;
+        double base_seconds = 0;
+
+        init_cache_or_exit(&cache, set_bits, ways[i], 0, POLICY_LRU, INDEX_MOD);
+        line_total = (size_t) cache.set_num * cache.line_num;
+        for (j = 0; j < (int) line_total; ++j) {
+            cache.tags[j] = j;
+            cache.valid[j] = true;
         }
-    if (!found_data) {
-        ++misses;
-        if (verbose) printf("miss ");
-        if (update_line(cache, set_index, tag)) {
-            ++evictions;
-            if (verbose) printf("eviction ");
+        for (j = 0; j < lookups; ++j) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            set_indices[j] = rng % cache.set_num;
+            // odd draws miss, even draws hit a random way of the set
+            keys[j] = (rng >> 32) & 1 ? line_total + (rng >> 40) % 1024
+                                      : set_indices[j] * ways[i] + (rng >> 40) % ways[i];
+        }
+        for (k = 0; k < probe_count; ++k)
+        {
+            struct timespec start;
+            volatile long sink = 0;
+            double seconds;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (j = 0; j < lookups; ++j) {
+                size_t base = (size_t) set_indices[j] * ways[i];
+                sink += probes[k].probe(cache.tags + base, cache.valid + base, ways[i], keys[j]);
+            }
+            seconds = elapsed_seconds(&start);
+            if (k == 0) base_seconds = seconds;
+            printf("%-8s %4d %12.1f %8.2fx\n", probes[k].name, ways[i], lookups / seconds / 1e6, base_seconds / seconds);
         }
+        free_cache(&cache);
     }
+    free(keys);
+    free(set_indices);
 }
 
-void store_cache(cache_struct* cache, int set_index, unsigned tag, bool verbose)
+/*
+ * bench_policy - time every replacement policy on a synthetic trace
+ *  (a reused hot region mixed with a streaming scan) at s=6, E=16, b=6
+ */
+void bench_policy()
 {
-    load_cache(cache, set_index, tag, verbose);
+    const int record_num = 1 << 22;
+    trace_record* records = malloc(record_num * sizeof(trace_record));
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+    unsigned stream = 0x10000000;
+    int policy, i;
+
+    if (!records) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    for (i = 0; i < record_num; ++i) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        records[i].op = "LLSM"[rng & 3];
+        records[i].size = 8;
+        records[i].addr = (rng >> 32) % 4 ? (rng >> 40) % (96 << 10) : (stream += 64);
+    }
+
+    printf("%-8s %14s %10s\n", "policy", "Maccesses/s", "miss rate");
+    for (policy = 0; policy < POLICY_NUM; ++policy)
+    {
+        cache_struct cache;
+        struct timespec start;
+        double seconds;
+        init_cache_or_exit(&cache, 6, 16, 6, policy, INDEX_MOD);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < record_num; ++i)
+            replay_record(&cache, &records[i], false);
+        seconds = elapsed_seconds(&start);
+        printf("%-8s %14.1f %10.4f\n", policy_names[policy], record_num / seconds / 1e6,
+               (double) cache.misses / (cache.hits + cache.misses));
+        free_cache(&cache);
+    }
+    free(records);
 }
 
-void modify_cache(cache_struct* cache, int set_index, unsigned tag, bool verbose)
+/*
+ * bench_api - accesses per second through the library, one call per access
+ * versus batches of increasing size
+ */
+void bench_api()
 {
-    load_cache(cache, set_index, tag, verbose);
-    load_cache(cache, set_index, tag, verbose);
+    const size_t access_num = 1 << 22;
+    const size_t batches[] = {1, 64, 4096, 1 << 22};
+    unsigned long long* addrs = malloc(access_num * sizeof(unsigned long long));
+    char* ops = malloc(access_num);
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+    unsigned stream = 0x10000000;
+    size_t i, j, k;
+
+    if (!addrs || !ops) {
+        printf("failed to allocate space!");
+        exit(0);
+    }
+    for (i = 0; i < access_num; ++i) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        ops[i] = "LLSM"[rng & 3];
+        addrs[i] = (rng >> 32) % 4 ? (rng >> 40) % (96 << 10) : (stream += 64);
+    }
+
+    printf("%-20s %14s %10s\n", "call", "Maccesses/s", "miss rate");
+    for (k = 0; k < sizeof(batches) / sizeof(batches[0]); ++k)
+    {
+        csim_cache* cache = csim_create(6, 16, 6, "lru", "mod");
+        csim_stats stats;
+        struct timespec start;
+        double seconds;
+        char name[32];
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (batches[k] == 1)
+            for (i = 0; i < access_num; ++i) csim_access(cache, addrs[i], ops[i], 8);
+        else
+            for (i = 0; i < access_num; i += j) {
+                j = access_num - i < batches[k] ? access_num - i : batches[k];
+                csim_access_many(cache, addrs + i, ops + i, NULL, j);
+            }
+        seconds = elapsed_seconds(&start);
+        csim_get_stats(cache, &stats);
+        if (batches[k] == 1) snprintf(name, sizeof(name), "csim_access");
+        else snprintf(name, sizeof(name), "access_many/%zu", batches[k]);
+        printf("%-20s %14.1f %10.4f\n", name, access_num / seconds / 1e6,
+               (double) stats.misses / (stats.hits + stats.misses));
+        csim_destroy(cache);
+    }
+    free(addrs);
+    free(ops);
 }
 
 void print_help_info()
@@ -134,24 +3400,135 @@ void print_help_info()
     printf("-s <num>   Number of set index bits.\n");
     printf("-E <num>   Number of lines per set.\n");
     printf("-b <num>   Number of block offset bits.\n");
-    printf("-t <file>  Trace file.\n\n\n");
+    printf("-t <file>  Trace file, - reads it from stdin.\n");
+    printf("-T <file>  Packed binary trace file (replaces -t).\n");
+    printf("-C <file>  Convert the -t trace to a packed binary trace and exit.\n");
+    printf("-S <spec>  Sweep mode: simulate every s:E:b geometry of the spec in one pass,\n");
+    printf("           fields take a value, a range lo-hi or a list v1/v2 (e.g. 0-6:1/2/4:5,10:8:6).\n");
+    printf("-j <num>   Number of worker threads (sweep mode, or set-partitioned replay;\n");
+    printf("           a verbose run is always serial).\n");
+    printf("-F <fmt>   Sweep output format: csv (default) or json.\n");
+    printf("-p <name>  Replacement policy: lru (default), fifo, random, plru, srrip or lfu.\n");
+    printf("-B <name>  Run a micro-benchmark and exit (probe, policy, api).\n");
+    printf("-i <name>  Set index function: mod (default), xor or hash.\n");
+    printf("-w <name>  Write policy: wb (write-back, default) or wt (write-through).\n");
+    printf("-a <name>  Store miss policy: alloc (write-allocate, default) or noalloc.\n");
+    printf("           Giving -w or -a also reports writebacks and traffic to the next level.\n");
+    printf("--l1i <s:E>, --l1d <s:E>, --l2 <s:E>, --llc <s:E>\n");
+    printf("           Multi-level mode: simulate the given levels (block size from -b,\n");
+    printf("           L1D defaults to -s/-E, policy from -p for every level).\n");
+    printf("--inclusion <name>  nine (default), inclusive or exclusive.\n");
+    printf("--attribute  Report the pages, regions and sets with the most misses\n");
+    printf("           (single level, serial replay).\n");
+    printf("--region-bits <num>  log2 of the attribution region size (default 20).\n");
+    printf("--top <num>  Number of entries per attribution report (default 10).\n");
+    printf("--classify  Split misses into compulsory, capacity and conflict misses\n");
+    printf("           (single level, serial replay).\n");
+    printf("--prefetch <next|stride|stream>  Model a hardware prefetcher (single level,\n");
+    printf("           serial replay).\n");
+    printf("--prefetch-degree <num>  Blocks fetched ahead per trigger (default 1).\n");
+    printf("--set-sample <num>  Simulate one set in <num> and extrapolate, with a 95%% ci.\n");
+    printf("--time-sample <ff,warm,measure>  Repeat windows of ff skipped, warm replayed and\n");
+    printf("           measure counted data records and extrapolate, with a 95%% ci.\n");
+    printf("--cores <num>  Simulate <num> coherent private caches (-s/-E or --l1d) over\n");
+    printf("           a shared LLC (--llc); trace lines carry a core id: op addr,size,core.\n");
+    printf("--coherence <mesi|moesi>  Coherence protocol for --cores (default mesi).\n");
+    printf("--tlb      Model a data TLB in front of the cache and report TLB mpki.\n");
+    printf("--page-size <4k|2m|1g>, --l1-tlb <s:E>, --l2-tlb <s:E>, --pwc <num>\n");
+    printf("           Page size (default 4k), TLB geometries (default 4:4 and 7:8)\n");
+    printf("           and page-walk cache entries per level (default 16).\n");
+    printf("--stack-distance  Print LRU results for every s' <= s and E' <= E from one pass (lru only).\n\n\n");
 }
+/* long-only options get values outside the range of short option characters */
+enum {
+    OPT_STACK_DISTANCE = 256,
+    OPT_L1I,
+    OPT_L1D,
+    OPT_L2,
+    OPT_LLC,
+    OPT_INCLUSION,
+    OPT_ATTRIBUTE,
+    OPT_REGION_BITS,
+    OPT_TOP,
+    OPT_CLASSIFY,
+    OPT_PREFETCH,
+    OPT_PREFETCH_DEGREE,
+    OPT_SET_SAMPLE,
+    OPT_TIME_SAMPLE,
+    OPT_CORES,
+    OPT_COHERENCE,
+    OPT_TLB,
+    OPT_PAGE_SIZE,
+    OPT_L1_TLB,
+    OPT_L2_TLB,
+    OPT_PWC
+};
+
 int main(int argc, char **argv)
 {
-    bool verbose;
-    int s, E, b;
+    bool verbose = false;
+    int s = -1, E = -1, b = -1;             // -1 until given
     cache_struct cache;
 
-    unsigned addr;
-    int size;
-    char operation[5];
-    int set_index;
-    unsigned tag;
+    trace_reader reader;
+    trace_record record;
 
     int c;
-    char trace_file_name[100];
+    const char* trace_file_name = NULL;
+    bool binary_trace = false;
+    char* convert_file_name = NULL;
+    char* sweep_spec = NULL;
+    int thread_num = 1;
+    bool json = false;
+    bool stack_distance_mode = false;
+    int policy = POLICY_LRU;
+    int index_fn = INDEX_MOD;
+    level_geometry geometry[LEVEL_NUM] = {{0, 0}, {0, 0}, {0, 0}, {0, 0}};
+    bool hierarchy_mode = false;
+    int inclusion = INCLUSION_NINE;
+    bool attribute = false;
+    int region_bits = 20, top = 10;
+    attribution attr;
+    bool classify = false;
+    miss_classifier classifier;
+    int prefetch_type = PREFETCH_NONE, prefetch_degree = 1;
+    prefetcher pf;
+    int set_sample = 0;
+    bool time_sample = false;
+    long long fast_forward = 0, warm_up = 0, measure = 0;
+    int core_num = 0, protocol = COHERENCE_MESI;
+    bool tlb_mode = false;
+    int page_bits = 12, pwc_entries = 16;
+    level_geometry tlb_geometry[2] = {{4, 4}, {7, 8}};
+    tlb_model tlb;
+    bool write_through = false, write_allocate = true, report_traffic = false;
 
-    while ((c = getopt(argc, argv, "hvs:E:b:t:")) != -1)
+    static const struct option long_options[] = {
+        {"stack-distance", no_argument, NULL, OPT_STACK_DISTANCE},
+        {"l1i", required_argument, NULL, OPT_L1I},
+        {"l1d", required_argument, NULL, OPT_L1D},
+        {"l2", required_argument, NULL, OPT_L2},
+        {"llc", required_argument, NULL, OPT_LLC},
+        {"inclusion", required_argument, NULL, OPT_INCLUSION},
+        {"attribute", no_argument, NULL, OPT_ATTRIBUTE},
+        {"region-bits", required_argument, NULL, OPT_REGION_BITS},
+        {"top", required_argument, NULL, OPT_TOP},
+        {"classify", no_argument, NULL, OPT_CLASSIFY},
+        {"prefetch", required_argument, NULL, OPT_PREFETCH},
+        {"prefetch-degree", required_argument, NULL, OPT_PREFETCH_DEGREE},
+        {"set-sample", required_argument, NULL, OPT_SET_SAMPLE},
+        {"time-sample", required_argument, NULL, OPT_TIME_SAMPLE},
+        {"cores", required_argument, NULL, OPT_CORES},
+        {"coherence", required_argument, NULL, OPT_COHERENCE},
+        {"tlb", no_argument, NULL, OPT_TLB},
+        {"page-size", required_argument, NULL, OPT_PAGE_SIZE},
+        {"l1-tlb", required_argument, NULL, OPT_L1_TLB},
+        {"l2-tlb", required_argument, NULL, OPT_L2_TLB},
+        {"pwc", required_argument, NULL, OPT_PWC},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hvs:E:b:t:T:C:S:j:F:p:i:w:a:B:", long_options, NULL)) != -1)
     {
         switch(c)
         {
@@ -160,16 +3537,180 @@ int main(int argc, char **argv)
                 break;
             case 's':
                 s = atoi(optarg);
+                if (s < 0 || s > MAX_SET_BITS) {
+                    printf("invalid number of set index bits!\n");
+                    exit(1);
+                }
                 break;
             case 'E':
                 E = atoi(optarg);
                 break;
             case 'b':
                 b = atoi(optarg);
+                if (b < 0 || b > 63) {
+                    printf("invalid number of block offset bits!\n");
+                    exit(1);
+                }
                 break;
             case 't':
-                strcpy(trace_file_name, optarg);
+                trace_file_name = optarg;
+                break;
+            case 'T':
+                trace_file_name = optarg;
+                binary_trace = true;
+                break;
+            case 'C':
+                convert_file_name = optarg;
+                break;
+            case 'S':
+                sweep_spec = optarg;
+                break;
+            case 'j':
+                thread_num = atoi(optarg);
+                break;
+            case 'F':
+                json = strcmp(optarg, "json") == 0;
+                break;
+            case OPT_STACK_DISTANCE:
+                stack_distance_mode = true;
+                break;
+            case OPT_L1I:
+            case OPT_L1D:
+            case OPT_L2:
+            case OPT_LLC:
+                parse_level_geometry(optarg, &geometry[LEVEL_L1I + c - OPT_L1I]);
+                hierarchy_mode = true;
+                break;
+            case OPT_INCLUSION:
+                for (inclusion = 0; inclusion < INCLUSION_NUM && strcmp(optarg, inclusion_names[inclusion]) != 0; ++inclusion);
+                if (inclusion == INCLUSION_NUM) {
+                    printf("unknown inclusion policy: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'p':
+                for (policy = 0; policy < POLICY_NUM && strcmp(optarg, policy_names[policy]) != 0; ++policy);
+                if (policy == POLICY_NUM) {
+                    printf("unknown replacement policy: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_ATTRIBUTE:
+                attribute = true;
+                break;
+            case OPT_REGION_BITS:
+                region_bits = atoi(optarg);
+                if (region_bits < 0 || region_bits > 63) {
+                    printf("invalid region size!\n");
+                    exit(1);
+                }
+                break;
+            case OPT_TOP:
+                top = atoi(optarg);
+                break;
+            case OPT_CLASSIFY:
+                classify = true;
+                break;
+            case OPT_PREFETCH:
+                for (prefetch_type = 0; prefetch_type < PREFETCH_NUM && strcmp(optarg, prefetch_names[prefetch_type]) != 0;
+                     ++prefetch_type);
+                if (prefetch_type == PREFETCH_NUM) {
+                    printf("unknown prefetcher: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_SET_SAMPLE:
+                set_sample = atoi(optarg);
+                if (set_sample < 1) {
+                    printf("invalid set sampling rate!\n");
+                    exit(1);
+                }
+                break;
+            case OPT_TIME_SAMPLE:
+                if (sscanf(optarg, "%lld,%lld,%lld", &fast_forward, &warm_up, &measure) != 3
+                    || fast_forward < 0 || warm_up < 0 || measure < 1) {
+                    printf("invalid time sampling windows: %s\n", optarg);
+                    exit(1);
+                }
+                time_sample = true;
+                break;
+            case OPT_CORES:
+                core_num = atoi(optarg);
+                if (core_num < 1 || core_num > MAX_CORES) {
+                    printf("invalid number of cores!\n");
+                    exit(1);
+                }
+                break;
+            case OPT_COHERENCE:
+                for (protocol = 0; protocol < COHERENCE_NUM && strcmp(optarg, coherence_names[protocol]) != 0;
+                     ++protocol);
+                if (protocol == COHERENCE_NUM) {
+                    printf("unknown coherence protocol: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_TLB:
+                tlb_mode = true;
+                break;
+            case OPT_PAGE_SIZE:
+                if (strcmp(optarg, "4k") == 0) page_bits = 12;
+                else if (strcmp(optarg, "2m") == 0) page_bits = 21;
+                else if (strcmp(optarg, "1g") == 0) page_bits = 30;
+                else {
+                    printf("unknown page size: %s\n", optarg);
+                    exit(1);
+                }
+                tlb_mode = true;
+                break;
+            case OPT_L1_TLB:
+            case OPT_L2_TLB:
+                parse_level_geometry(optarg, &tlb_geometry[c - OPT_L1_TLB]);
+                tlb_mode = true;
                 break;
+            case OPT_PWC:
+                pwc_entries = atoi(optarg);
+                if (pwc_entries < 1) {
+                    printf("invalid page-walk cache size!\n");
+                    exit(1);
+                }
+                tlb_mode = true;
+                break;
+            case OPT_PREFETCH_DEGREE:
+                prefetch_degree = atoi(optarg);
+                if (prefetch_degree < 1) {
+                    printf("invalid prefetch degree!\n");
+                    exit(1);
+                }
+                break;
+            case 'i':
+                for (index_fn = 0; index_fn < INDEX_NUM && strcmp(optarg, index_names[index_fn]) != 0; ++index_fn);
+                if (index_fn == INDEX_NUM) {
+                    printf("unknown set index function: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                if (strcmp(optarg, "wb") != 0 && strcmp(optarg, "wt") != 0) {
+                    printf("unknown write policy: %s\n", optarg);
+                    exit(1);
+                }
+                write_through = strcmp(optarg, "wt") == 0;
+                report_traffic = true;
+                break;
+            case 'a':
+                if (strcmp(optarg, "alloc") != 0 && strcmp(optarg, "noalloc") != 0) {
+                    printf("unknown store miss policy: %s\n", optarg);
+                    exit(1);
+                }
+                write_allocate = strcmp(optarg, "alloc") == 0;
+                report_traffic = true;
+                break;
+            case 'B':
+                if (strcmp(optarg, "probe") == 0) bench_probe();
+                else if (strcmp(optarg, "policy") == 0) bench_policy();
+                else if (strcmp(optarg, "api") == 0) bench_api();
+                else printf("unknown benchmark: %s\n", optarg);
+                exit(0);
             case 'h':
                 print_help_info();
                 exit(0);
@@ -178,27 +3719,124 @@ int main(int argc, char **argv)
         }
     }
 
-    init_cache(&cache, s, E);
+    if (!trace_file_name) {
+        print_help_info();
+        exit(1);
+    }
 
-    FILE* trace_file = fopen(trace_file_name, "r");
-    while(fscanf(trace_file ,"%s %x,%d", operation, &addr, &size) != EOF)
-    {
-        if (strcmp(operation, "I") == 0) continue;
-        set_index = (addr >> b) & ((1 << s) - 1);
-        tag = addr >> (b + s);
-        if (verbose) printf("%s %x,%d ",operation, addr, size);
-        if (strcmp(operation, "L") == 0) {
-            load_cache(&cache, set_index, tag, verbose);
+    if (convert_file_name) {
+        convert_trace(trace_file_name, convert_file_name);
+        return 0;
+    }
+
+    if (sweep_spec) {
+        run_sweep(sweep_spec, trace_file_name, binary_trace, policy, index_fn, thread_num, json);
+        return 0;
+    }
+
+    // the block size always comes from -b, the (L1D) geometry from -s and -E unless --l1d gave it
+    if (b < 0 || ((!(core_num || hierarchy_mode) || geometry[LEVEL_L1D].E == 0) && (s < 0 || E < 0))) {
+        print_help_info();
+        exit(1);
+    }
+
+    if (core_num) {
+        if (geometry[LEVEL_L1D].E == 0) {
+            geometry[LEVEL_L1D].s = s;
+            geometry[LEVEL_L1D].E = E;
+        }
+        if (geometry[LEVEL_LLC].E == 0) {
+            geometry[LEVEL_LLC].s = geometry[LEVEL_L1D].s + 2;
+            geometry[LEVEL_LLC].E = geometry[LEVEL_L1D].E;
+        }
+        run_coherent(trace_file_name, binary_trace, core_num, protocol, &geometry[LEVEL_L1D], &geometry[LEVEL_LLC],
+                     b, policy, index_fn, top);
+        return 0;
+    }
+
+    if (hierarchy_mode) {
+        if (geometry[LEVEL_L1D].E == 0) {
+            geometry[LEVEL_L1D].s = s;
+            geometry[LEVEL_L1D].E = E;
+        }
+        run_hierarchy(trace_file_name, binary_trace, geometry, b, policy, index_fn, inclusion);
+        return 0;
+    }
+
+    if (stack_distance_mode) {
+        if (policy != POLICY_LRU || index_fn != INDEX_MOD) {
+            printf("stack distance analysis only models lru with mod indexing!\n");
+            exit(1);
+        }
+        run_stack_distance(trace_file_name, binary_trace, s, E, b, json);
+        return 0;
+    }
+
+    init_cache_or_exit(&cache, s, E, b, policy, index_fn);
+    cache.write_through = write_through;
+    cache.write_allocate = write_allocate;
+
+    if (attribute) init_attribution(&attr, cache.set_num, region_bits, top);
+    if (classify) init_classifier(&classifier, (long) cache.set_num * cache.line_num);
+    if (prefetch_type) init_prefetcher(&pf, &cache, prefetch_type, prefetch_degree);
+    if (tlb_mode) init_tlb(&tlb, page_bits, &tlb_geometry[0], &tlb_geometry[1], pwc_entries);
+
+    open_trace(&reader, trace_file_name, binary_trace);
+    if (set_sample || time_sample) {
+        if (attribute || classify || prefetch_type || tlb_mode) {
+            printf("sampling can not be combined with --attribute, --classify, --prefetch or --tlb!\n");
+            exit(1);
         }
-        if (strcmp(operation, "S") == 0) {
-            store_cache(&cache, set_index, tag, verbose);
+        if (set_sample) run_set_sampled(&cache, &reader, set_sample, verbose);
+        else run_time_sampled(&cache, &reader, fast_forward, warm_up, measure, verbose);
+        close_trace(&reader);
+        free_cache(&cache);
+        return 0;
+    }
+    if (thread_num > 1 && !verbose && !attribute && !classify && !prefetch_type && !tlb_mode) replay_parallel(&cache, &reader, thread_num);
+    else while (next_record(&reader, &record))
+    {
+        if (record.op == 'I') {
+            if (tlb_mode) ++tlb.instructions;
+            continue;
         }
-        if (strcmp(operation, "M") == 0) {
-            modify_cache(&cache, set_index, tag, verbose);
+        if (attribute || classify || prefetch_type || tlb_mode) {
+            long long misses, useful = cache.useful_prefetches;
+            if (tlb_mode) tlb_translate(&tlb, &cache, record.addr);
+            misses = cache.misses;
+            replay_record(&cache, &record, verbose);
+            misses = cache.misses - misses;
+            if (prefetch_type)
+                prefetch_access(&pf, &cache, record.addr, misses || cache.useful_prefetches != useful);
+            if (attribute)
+                attribute_access(&attr, record.addr,
+                                 block_set_index(&cache, record.addr >> cache.block_bits, cache.index_fn),
+                                 record.op == 'M' ? 2 : 1, misses);
+            if (classify) classify_access(&classifier, record.addr >> cache.block_bits, misses);
         }
-        if (verbose) printf("\n");
+        else replay_record(&cache, &record, verbose);
     }
+    close_trace(&reader);
 
-    printSummary(hits, misses, evictions);
+    printSummary(cache.hits, cache.misses, cache.evictions);
+    if (report_traffic)
+        printf("writebacks:%lld bytes_read:%lld bytes_written:%lld\n",
+               cache.writebacks, cache.bytes_read, cache.bytes_written);
+    if (prefetch_type) print_prefetch_stats(&pf, &cache);
+    if (tlb_mode) {
+        print_tlb_stats(&tlb, &cache);
+        free_tlb(&tlb);
+    }
+    if (classify) {
+        printf("compulsory:%lld capacity:%lld conflict:%lld\n", classifier.compulsory, classifier.capacity,
+               classifier.conflict);
+        free_classifier(&classifier);
+    }
+    if (attribute) {
+        print_attribution(&attr);
+        free_attribution(&attr);
+    }
+    free_cache(&cache);
     return 0;
 }
+#endif
@@ -0,0 +1,57 @@
+/*
+ * csim.h - embeddable interface to the cache simulator in csim.c
+ *
+ * Build csim.c with -DCSIM_NO_MAIN to link it into another program. Each
+ * csim_cache is an independent simulated cache; the library keeps no global
+ * state, so different caches may be driven from different threads.
+ */
+#ifndef CSIM_H
+#define CSIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* access kinds, the op characters of valgrind lackey traces */
+#define CSIM_LOAD 'L'
+#define CSIM_STORE 'S'
+#define CSIM_MODIFY 'M'
+
+typedef struct csim_cache csim_cache;
+
+typedef struct {
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long writebacks;
+    long long bytes_read;
+    long long bytes_written;
+} csim_stats;
+
+/*
+ * csim_create - a cache of 2^s sets of E lines of 2^b bytes
+ *  policy is one of "lru", "fifo", "random", "plru", "srrip", "lfu" and
+ *  index one of "mod", "xor", "hash" (NULL means lru / mod).
+ *  returns NULL if the geometry or a name is invalid
+ */
+csim_cache* csim_create(int s, int E, int b, const char* policy, const char* index);
+void csim_destroy(csim_cache* cache);
+
+/* write-back / write-allocate by default */
+void csim_set_write_policy(csim_cache* cache, bool write_through, bool write_allocate);
+
+/* one access of `size` bytes at `addr`, `op` is CSIM_LOAD, CSIM_STORE or CSIM_MODIFY */
+void csim_access(csim_cache* cache, unsigned long long addr, char op, int size);
+
+/*
+ * csim_access_many - `n` accesses in trace order
+ *  the policy and index dispatch happens once per batch instead of once per
+ *  access; `sizes` gives the size of each access as csim_access does, NULL
+ *  makes every access 8 bytes
+ */
+void csim_access_many(csim_cache* cache, const unsigned long long* addrs, const char* ops, const int* sizes,
+                      size_t n);
+
+void csim_get_stats(const csim_cache* cache, csim_stats* stats);
+void csim_reset_stats(csim_cache* cache);
+
+#endif
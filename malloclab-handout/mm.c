@@ -2,16 +2,50 @@
  * CSAPP Malloc Lab
  * by libertyeagle
  * Implementation:
- *  - using linux's buddy system like solution (segregated free list)
- *  - free list size classes are power of 2
- *  - 32; 64; 128; 256; 512; 1024; 2048
- *  - blocks within each free list are sorted in ascending order
+ *  - segregated free lists, two level size classes:
+ *      each power of 2 range [2^k, 2^(k+1)) below 4096 is split into 4 classes,
+ *      blocks of 4096 bytes and more share one large class
+ *  - free lists are LIFO, so inserting and removing a block is O(1);
+ *      find_fit takes the best fit of the requested class, since a class is
+ *      narrow (1/4 of a power of 2) this stays close to global best fit
  *  - maintain an explicit free list for each size class
- *  - 4 words are required for each free block, so min size class is 32
+ *  - the large class is a treap once it holds more than LARGE_LIST_MAX blocks,
+ *      keyed on (size, address) and heap ordered on a hash of the address, so
+ *      lookup, insert and remove are O(log n) expected and find_fit is an exact
+ *      best fit; below that it is a LIFO list scanned for the same block, and
+ *      it turns back into one when it falls to half of LARGE_LIST_MAX
+ *  - two level bitmaps of non-empty classes (a bit per power of 2 range, a bit
+ *      per class), so find_fit reaches the next non-empty class with one ctz
+ *  - a free large block keeps its left and right child in the pred / succ words
+ *      and its priority in the word after them; a block that grows by
+ *      coalescing or shrinks by a split takes over its old node when no other
+ *      key lies in between, instead of a remove and an insert
+ *  - a large free block at the end of the heap (the wilderness) is kept out
+ *      of the treap, find_fit takes it where the treap would have, carving
+ *      from it or merging into it costs no treap update
+ *  - 4 words are required for each free block, so min block size is 16
+ *  - bit 1 of a header tells if the previous block is allocated, only free
+ *      blocks have a footer, it is read to find the previous block when
+ *      coalescing with it
  *  - for each allocated block:
- *      header, payload, (optional) padding, footer
+ *      header, payload, (optional) padding
  *  - for each free block:
  *      header, predecessor, successor, footer
+ *  - requests of up to 128 bytes go to slabs: blocks starting on a 2048 byte
+ *      page, holding objects of one size class (multiples of 8) without headers,
+ *      a slab keeps a free object list, a bump pointer for objects never
+ *      used and a live count in its first 6 words
+ *  - slabs with free objects are linked per class, a bitmap with a bit per
+ *      page (an allocated block, doubled when a slab lies beyond it) tells
+ *      mm_free and mm_realloc if a pointer is a slab object; an empty slab
+ *      goes back to the heap unless it is the last one of its class
+ *  - the list heads of the slab classes share the block of the bitmap, a heap
+ *      without slabs pays for neither; a class gets its first slab once its
+ *      live blocks take as much heap as 2 slabs, until then its requests are
+ *      plain blocks
+ *  - a slab is carved from a free block holding an aligned page, or at the end
+ *      of the heap; while the block mm_realloc grew last ends the heap the free
+ *      block behind it is searched last, so that block can keep growing in place
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,6 +84,7 @@ team_t team = {
 
 #define BLOCK_FREE 0
 #define BLOCK_ALLOCATED 1
+#define PREV_ALLOCATED 2
 
 #define WSIZE 4
 #define DSIZE 8
@@ -64,28 +99,109 @@ team_t team = {
 
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & 0x2)
+
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOCATED)
+#define CLEAR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOCATED)
 
 #define HDRP(bp) ((char *)(bp) - WSIZE)
-#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)   // free blocks only
 
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
-#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))   // previous block must be free
 
 #define FREE_BLOCK_PRED(bp) ((char *)(bp))
 #define FREE_BLOCK_SUCC(bp) ((char *)(bp) + WSIZE)
 
+#define TREE_LEFT(bp) ((char *)(bp))
+#define TREE_RIGHT(bp) ((char *)(bp) + WSIZE)
+#define TREE_PRIORITY(bp) ((char *)(bp) + 2 * WSIZE)
+#define TREE_KEY(size, bp) (((unsigned long long)(size) << 32) | (unsigned int)(size_t)(bp))
+
+/* size classes: class (k - FL_MIN) * SL_COUNT + j holds [2^k + j * 2^(k-2), 2^k + (j+1) * 2^(k-2)) */
+#define SL_BITS 2
+#define SL_COUNT (1 << SL_BITS)
+#define FL_MIN 4                    // minimum block size is 16 bytes
+#define FL_LARGE 12                 // blocks of 4096 bytes and more go to the large class
+#define LARGE_CLASS ((FL_LARGE - FL_MIN) * SL_COUNT)
+#define CLASS_NUM (LARGE_CLASS + 1)
+#define FL_COUNT (FL_LARGE - FL_MIN)
+#define LARGE_LIST_MAX 32           // the large class is a list up to this many blocks, a treap above
+
+/* slabs: a slab is the first page of an allocated block, its objects end before the next header */
+#define SLAB_SIZE 2048                          // slab page, 1024 and 4096 gave less total utilization
+#define SLAB_BITS 11
+#define SLAB_MAX 128                            // largest object served by a slab
+#define SLAB_CLASS_NUM (SLAB_MAX / DSIZE)
+#define SLAB_HSIZE (6 * WSIZE)
+#define SMALL_UPPER 0x4                         // header bit of an allocated small block, see count_small
+// n live blocks of class c take as much heap as 2 slabs (or n fills its byte), c is served by slabs then
+#define SLAB_FIRST(c, n) ((n) == 0xff || (n) * ((c) + 2) * DSIZE >= 2 * SLAB_SIZE)
+
+#define SLAB_OF(bp) ((char *)((size_t)(bp) & ~(size_t)(SLAB_SIZE - 1)))
+#define SLAB_OBJ_SIZE(s) ((char *)(s))
+#define SLAB_FREE(s) ((char *)(s) + WSIZE)
+#define SLAB_BUMP(s) ((char *)(s) + 2 * WSIZE)
+#define SLAB_LIVE(s) ((char *)(s) + 3 * WSIZE)
+#define SLAB_NEXT(s) ((char *)(s) + 4 * WSIZE)
+#define SLAB_PREV(s) ((char *)(s) + 5 * WSIZE)
+#define SLAB_END(s) ((char *)(s) + SLAB_SIZE - WSIZE)
+
+// non-empty classes of power of 2 range `fl`, one bit per class
+#define SL_MAP(fl) ((sl_bitmap >> ((fl) * SL_COUNT)) & ((1u << SL_COUNT) - 1))
+
 static void *extend_heap(size_t double_words);
-static void *get_segregated_free_list_index(size_t size);
+static unsigned int get_size_class(size_t size);
+static void mark_class(unsigned int i);
+static void unmark_class(unsigned int i);
 static void insert_to_free_list(void *bp);
 static void remove_from_free_list(void *bp);
+static void replace_free_block(void *old, void *bp, size_t size, unsigned int prev_alloc);
 static void *coalesce(void *bp);
+static void *list_fit(size_t size);
 static void *find_fit(size_t size);
+static void *grown_fit(size_t size);
+static int tree_less(char *a, char *b);
+static void tree_insert(char *root_pointer, char *bp);
+static void tree_unlink(char *link, char *bp);
+static void tree_remove(char *root_pointer, char *bp);
+static void tree_replace(char *root_pointer, char *old, unsigned long long old_key, char *bp);
+static void *tree_best_fit(char *root_pointer, size_t size);
+static void large_to_tree(char *root_pointer);
+static void large_to_list(char *root_pointer);
+static void *large_fit(size_t size);
 static void place(void *bp, size_t asize);
 static void place_realloc(void *bp, size_t asize);
 static void *coalesce_realloc(void *bp, size_t new_size);
+static void *block_alloc(size_t size);
+static int in_slab(void *bp);
+static void set_slab_page(char *slab, int on);
+static int grow_slab_map(size_t page);
+static char *slab_page(char *h);
+static char *carve_slab(char *h, size_t size, char *slab);
+static char *new_slab(unsigned int cls);
+static void slab_link(char *slab);
+static void slab_unlink(char *slab);
+static void *slab_alloc(unsigned int cls);
+static void slab_free(void *bp);
+static inline void set_small_class(void *bp, size_t size);
+static inline void count_small(void *bp, int up);
 
 static char *heap_listp;
 static char *free_list_pointer;
+static char *wilderness;         // large free block ending the heap, on no list, or NULL
+static char *grown;              // block mm_realloc grew last, NULL once it is freed
+static char *slab_roots;         // SLAB_CLASS_NUM heads of the lists of slabs with free objects, in front of slab_map
+static char *slab_map;           // a bit per page from slab_base
+static size_t slab_map_pages;    // pages covered by slab_map
+static char *slab_base;
+static unsigned int fl_bitmap;   // bit k: power of 2 range k has a non-empty class, bit FL_COUNT: large class
+static unsigned int sl_bitmap;   // bit i: class i is non-empty, SL_COUNT bits per range
+static unsigned int large_count; // blocks in the large class
+static int large_tree;           // the large class is a treap, not a list
+static unsigned int slab_classes;        // bit c: slab class c is served by slabs
+static unsigned long long small_live_lo;  // a byte per slab class 0 to 7: live plain blocks of that class
+static unsigned long long small_live_hi;  // the same for slab classes 8 to 15
 
 /*
  * extend_heap - extends the heap with a new free block
@@ -102,7 +218,8 @@ static void *extend_heap(size_t double_words)
     
     if ((long)(bp = mem_sbrk(size)) == (void *) -1) return NULL;
 
-    PUT(HDRP(bp), PACK(size, BLOCK_FREE));         // fill header (location at bp - WSIZE)
+    // fill header (location at bp - WSIZE), the old epilogue knows if the last block is allocated
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_FREE));
     PUT(FTRP(bp), PACK(size, BLOCK_FREE));         // fill footer
 
     PUT(FREE_BLOCK_PRED(bp), NULL);       // set `pred` field in the new free block
@@ -114,55 +231,279 @@ static void *extend_heap(size_t double_words)
 }
 
 /*
- * get_segregated_free_list_index - given `size`, return apporatiate free list index
+ * get_size_class - given `size`, return its size class
+ *  the index of the highest set bit picks the power of 2 range, the next
+ *  SL_BITS bits the class within it
  */
-static void *get_segregated_free_list_index(size_t size)
+static unsigned int get_size_class(size_t size)
 {
-    unsigned int i;
-    if (size <= 32) i = 0;
-    else if (size <= 64) i = 1;
-    else if (size <= 128) i = 2;
-    else if (size <= 256) i = 3;
-    else if (size <= 512) i = 4;
-    else if (size <= 1024) i = 5;
-    else if (size <= 2048) i = 6;
-    else if (size <= 4096) i = 7;
-    else i = 8;
+    unsigned int fl;
+    if (size >= (1 << FL_LARGE)) return LARGE_CLASS;
+    fl = 31 - __builtin_clz((unsigned int) size);
+    return (fl - FL_MIN) * SL_COUNT + ((size >> (fl - SL_BITS)) & (SL_COUNT - 1));
+}
 
-    return free_list_pointer + i * WSIZE;
+/*
+ * mark_class - class `i` just became non-empty
+ */
+static void mark_class(unsigned int i)
+{
+    fl_bitmap |= 1u << (i / SL_COUNT);
+    if (i != LARGE_CLASS) sl_bitmap |= 1u << i;
 }
 
 /*
- * insert_to_free_list - insert given block to free list
+ * unmark_class - class `i` just became empty
+ *  the range bit is cleared once all of its classes are empty
  */
-static void insert_to_free_list(void *bp)
+static void unmark_class(unsigned int i)
+{
+    unsigned int fl = i / SL_COUNT;
+    if (i != LARGE_CLASS) {
+        sl_bitmap &= ~(1u << i);
+        if (SL_MAP(fl) != 0) return;
+    }
+    fl_bitmap &= ~(1u << fl);
+}
+
+/*
+ * tree_less - order of the large block treap: by size, then by address
+ *  both fit in 32 bits (block pointers are stored in words), so they are
+ *  compared as one 64-bit key
+ */
+static int tree_less(char *a, char *b)
+{
+    return TREE_KEY(GET_SIZE(HDRP(a)), a) < TREE_KEY(GET_SIZE(HDRP(b)), b);
+}
+
+/*
+ * tree_insert - insert a large free block into the treap at `root_pointer`
+ *  walk down while the nodes outrank bp, then split the rest of the path
+ *  into bp's left (smaller) and right (larger) subtrees
+ */
+static void tree_insert(char *root_pointer, char *bp)
+{
+    char *link = root_pointer;
+    char *node = GET(link);
+    char *left_link = TREE_LEFT(bp);
+    char *right_link = TREE_RIGHT(bp);
+
+    PUT(TREE_PRIORITY(bp), (unsigned int)(size_t) bp * 2654435761u);
+    while (node != NULL && GET(TREE_PRIORITY(node)) > GET(TREE_PRIORITY(bp))) {
+        link = tree_less(bp, node) ? TREE_LEFT(node) : TREE_RIGHT(node);
+        node = GET(link);
+    }
+    PUT(link, bp);
+
+    while (node != NULL) {
+        if (tree_less(node, bp)) {
+            PUT(left_link, node);
+            left_link = TREE_RIGHT(node);
+            node = GET(left_link);
+        }
+        else {
+            PUT(right_link, node);
+            right_link = TREE_LEFT(node);
+            node = GET(right_link);
+        }
+    }
+    PUT(left_link, NULL);
+    PUT(right_link, NULL);
+}
+
+/*
+ * tree_unlink - merge the subtrees of bp into `link`, the link pointing to bp
+ */
+static void tree_unlink(char *link, char *bp)
+{
+    char *left, *right;
+
+    left = GET(TREE_LEFT(bp));
+    right = GET(TREE_RIGHT(bp));
+    while (left != NULL && right != NULL) {
+        if (GET(TREE_PRIORITY(left)) > GET(TREE_PRIORITY(right))) {
+            PUT(link, left);
+            link = TREE_RIGHT(left);
+            left = GET(link);
+        }
+        else {
+            PUT(link, right);
+            link = TREE_LEFT(right);
+            right = GET(link);
+        }
+    }
+    PUT(link, left != NULL ? left : right);
+}
+
+/*
+ * tree_remove - remove bp from the treap at `root_pointer`
+ *  find the link to bp by its key, then merge its subtrees in its place
+ */
+static void tree_remove(char *root_pointer, char *bp)
+{
+    char *link = root_pointer;
+    char *node = GET(link);
+
+    while (node != bp) {
+        link = tree_less(bp, node) ? TREE_LEFT(node) : TREE_RIGHT(node);
+        node = GET(link);
+    }
+    tree_unlink(link, bp);
+}
+
+/*
+ * tree_replace - put bp in the treap at `root_pointer` in place of `old`, inserted with `old_key`
+ *  when no other key lies between the two, bp takes over old's node with its
+ *  children and priority and the shape of the treap does not change,
+ *  otherwise old is unlinked where it was found and bp inserted.
+ *  the header of bp already holds its size
+ */
+static void tree_replace(char *root_pointer, char *old, unsigned long long old_key, char *bp)
+{
+    char *link = root_pointer;
+    char *node = GET(link);
+    unsigned long long key = TREE_KEY(GET_SIZE(HDRP(bp)), bp);
+    unsigned long long low = 0, high = ~0ULL;   // nearest keys around old
+
+    while (node != old) {
+        unsigned long long node_key = TREE_KEY(GET_SIZE(HDRP(node)), node);
+        if (old_key < node_key) {
+            high = node_key;
+            link = TREE_LEFT(node);
+        }
+        else {
+            low = node_key;
+            link = TREE_RIGHT(node);
+        }
+        node = GET(link);
+    }
+
+    if (key > old_key)
+        for (node = GET(TREE_RIGHT(old)); node != NULL; node = GET(TREE_LEFT(node)))
+            high = TREE_KEY(GET_SIZE(HDRP(node)), node);
+    else
+        for (node = GET(TREE_LEFT(old)); node != NULL; node = GET(TREE_RIGHT(node)))
+            low = TREE_KEY(GET_SIZE(HDRP(node)), node);
+
+    if (key <= low || key >= high) {
+        tree_unlink(link, old);
+        tree_insert(root_pointer, bp);
+    }
+    else if (bp != old) {
+        PUT(link, bp);
+        PUT(TREE_LEFT(bp), GET(TREE_LEFT(old)));
+        PUT(TREE_RIGHT(bp), GET(TREE_RIGHT(old)));
+        PUT(TREE_PRIORITY(bp), GET(TREE_PRIORITY(old)));
+    }
+}
+
+/*
+ * tree_best_fit - smallest block of at least `size` bytes in the treap, lowest address among equals
+ */
+static void *tree_best_fit(char *root_pointer, size_t size)
+{
+    char *node = GET(root_pointer);
+    char *best = NULL;
+
+    while (node != NULL) {
+        if (GET_SIZE(HDRP(node)) >= size) {
+            best = node;
+            node = GET(TREE_LEFT(node));
+        }
+        else node = GET(TREE_RIGHT(node));
+    }
+    return best;
+}
+
+/*
+ * large_to_tree - turn the list of the large class at `root_pointer` into a treap
+ */
+static void large_to_tree(char *root_pointer)
 {
-    char *root_pointer = get_segregated_free_list_index(GET_SIZE(HDRP(bp)));
-    char *prev_free_block = root_pointer;
-    char *next_free_block = GET(prev_free_block);
+    char *bp = GET(root_pointer);
+    char *next;
 
-    while (next_free_block != NULL) {
-        // find the correct position to insert, right before the first free block whose size is larger than bp.
-        // ensure that blocks are sorted by size for each free list
-        if (GET_SIZE(HDRP(next_free_block)) >= GET_SIZE(HDRP(bp))) break;
-        prev_free_block = next_free_block;
-        next_free_block = GET(FREE_BLOCK_SUCC(next_free_block));
+    PUT(root_pointer, NULL);
+    for (; bp != NULL; bp = next) {
+        next = GET(FREE_BLOCK_SUCC(bp));
+        tree_insert(root_pointer, bp);
     }
+    large_tree = 1;
+}
 
-    if (prev_free_block == root_pointer) {
-        // insert to head
-        PUT(root_pointer, bp);
+/*
+ * large_to_list - turn the treap of the large class at `root_pointer` into a list
+ *  the root is unlinked until the treap is empty
+ */
+static void large_to_list(char *root_pointer)
+{
+    char *head = NULL;
+    char *bp;
+
+    while ((bp = GET(root_pointer)) != NULL) {
+        tree_unlink(root_pointer, bp);
         PUT(FREE_BLOCK_PRED(bp), NULL);
-        PUT(FREE_BLOCK_SUCC(bp), next_free_block);
-        if (next_free_block != NULL) PUT(FREE_BLOCK_PRED(next_free_block), bp);
+        PUT(FREE_BLOCK_SUCC(bp), head);
+        if (head != NULL) PUT(FREE_BLOCK_PRED(head), bp);
+        head = bp;
     }
-    else {
-        // otherwise
-        PUT(FREE_BLOCK_SUCC(prev_free_block), bp);
-        PUT(FREE_BLOCK_PRED(bp), prev_free_block);
-        PUT(FREE_BLOCK_SUCC(bp), next_free_block);
-        if (next_free_block != NULL) PUT(FREE_BLOCK_PRED(next_free_block), bp);
+    PUT(root_pointer, head);
+    large_tree = 0;
+}
+
+/*
+ * large_fit - smallest large block of at least `size` bytes, lowest address among equals
+ *  a list is scanned whole so it gives the block the treap would
+ */
+static void *large_fit(size_t size)
+{
+    char *root_pointer = free_list_pointer + LARGE_CLASS * WSIZE;
+    char *best = NULL;
+    size_t best_size = 0;
+    char *bp;
+
+    if (large_tree) return tree_best_fit(root_pointer, size);
+    for (bp = GET(root_pointer); bp != NULL; bp = GET(FREE_BLOCK_SUCC(bp))) {
+        size_t bsize = GET_SIZE(HDRP(bp));
+        if (bsize >= size && (best == NULL || bsize < best_size || (bsize == best_size && bp < best))) {
+            best = bp;
+            best_size = bsize;
+        }
+    }
+    return best;
+}
+
+/*
+ * insert_to_free_list - insert given block to the head of its free list
+ *  or into the treap if it is a large block, a large block ending the heap
+ *  becomes the wilderness instead
+ */
+static void insert_to_free_list(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int i;
+    char *root_pointer, *next_free_block;
+
+    if (size >= (1 << FL_LARGE) && GET_SIZE(HDRP((char *)bp + size)) == 0) {     // the epilogue follows
+        wilderness = bp;
+        return;
+    }
+    i = get_size_class(size);
+    root_pointer = free_list_pointer + i * WSIZE;
+    next_free_block = GET(root_pointer);
+
+    if (next_free_block == NULL) mark_class(i);
+    if (i == LARGE_CLASS) ++large_count;
+    if (i == LARGE_CLASS && large_tree) {
+        tree_insert(root_pointer, bp);
+        return;
     }
+
+    PUT(root_pointer, bp);
+    PUT(FREE_BLOCK_PRED(bp), NULL);
+    PUT(FREE_BLOCK_SUCC(bp), next_free_block);
+    if (next_free_block != NULL) PUT(FREE_BLOCK_PRED(next_free_block), bp);
+    if (i == LARGE_CLASS && large_count > LARGE_LIST_MAX) large_to_tree(root_pointer);
 }
 
 /*
@@ -170,9 +511,27 @@ static void insert_to_free_list(void *bp)
  */
 static void remove_from_free_list(void *bp)
 {
-    char *root_pointer = get_segregated_free_list_index(GET_SIZE(HDRP(bp)));
-    char *prev_free_block = GET(FREE_BLOCK_PRED(bp));
-    char *next_free_block = GET(FREE_BLOCK_SUCC(bp));
+    unsigned int i;
+    char *root_pointer, *prev_free_block, *next_free_block;
+
+    if (bp == wilderness) {
+        wilderness = NULL;
+        return;
+    }
+    i = get_size_class(GET_SIZE(HDRP(bp)));
+    root_pointer = free_list_pointer + i * WSIZE;
+    prev_free_block = GET(FREE_BLOCK_PRED(bp));
+    next_free_block = GET(FREE_BLOCK_SUCC(bp));
+
+    if (i == LARGE_CLASS) --large_count;
+    if (i == LARGE_CLASS && large_tree) {
+        tree_remove(root_pointer, bp);
+        PUT(TREE_LEFT(bp), NULL);
+        PUT(TREE_RIGHT(bp), NULL);
+        if (large_count <= LARGE_LIST_MAX / 2) large_to_list(root_pointer);
+        if (GET(root_pointer) == NULL) unmark_class(i);
+        return;
+    }
 
     if (prev_free_block != NULL) {
         // has previous free block
@@ -181,6 +540,7 @@ static void remove_from_free_list(void *bp)
     }
     else {
         if (next_free_block != NULL) PUT(FREE_BLOCK_PRED(next_free_block), NULL);
+        else unmark_class(i);
         PUT(root_pointer, next_free_block);
     }
 
@@ -188,60 +548,147 @@ static void remove_from_free_list(void *bp)
     PUT(FREE_BLOCK_SUCC(bp), NULL);
 }
 
+/*
+ * replace_free_block - make bp a free block of `size` bytes in place of the free block `old`
+ *  old grows into bp by coalescing, or bp is what a split leaves of it.
+ *  the wilderness only moves while it stays large, a large block that stays large goes through
+ *  tree_replace or takes over old's place in the list, anything else (and a
+ *  block reaching the end of the heap) is a remove and an insert
+ */
+static void replace_free_block(void *old, void *bp, size_t size, unsigned int prev_alloc)
+{
+    size_t old_size = GET_SIZE(HDRP(old));
+    int stays_large;
+
+    if (old == wilderness && size >= (1 << FL_LARGE)) {
+        // bp ends the heap as well, it stays the wilderness
+        PUT(HDRP(bp), PACK(size, prev_alloc | BLOCK_FREE));
+        PUT(FTRP(bp), PACK(size, BLOCK_FREE));
+        wilderness = bp;
+        return;
+    }
+
+    stays_large = old_size >= (1 << FL_LARGE) && size >= (1 << FL_LARGE)
+                  && GET_SIZE(HDRP((char *)bp + size)) != 0;
+    if (!stays_large) remove_from_free_list(old);
+    PUT(HDRP(bp), PACK(size, prev_alloc | BLOCK_FREE));
+    PUT(FTRP(bp), PACK(size, BLOCK_FREE));
+    if (!stays_large) insert_to_free_list(bp);
+    else if (large_tree) tree_replace(free_list_pointer + LARGE_CLASS * WSIZE, old, TREE_KEY(old_size, old), bp);
+    else if (bp != old) {
+        char *pred = GET(FREE_BLOCK_PRED(old));
+        char *succ = GET(FREE_BLOCK_SUCC(old));
+        PUT(FREE_BLOCK_PRED(bp), pred);
+        PUT(FREE_BLOCK_SUCC(bp), succ);
+        if (pred != NULL) PUT(FREE_BLOCK_SUCC(pred), bp);
+        else PUT(free_list_pointer + LARGE_CLASS * WSIZE, bp);
+        if (succ != NULL) PUT(FREE_BLOCK_PRED(succ), bp);
+    }
+}
+
 /*
  * coalesce - coalescing target block to merge it with any adjacent free blocks
  */
 static void *coalesce(void *bp)
 {
-    unsigned int prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     unsigned int next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 
     size_t size = GET_SIZE(HDRP(bp));
 
-    if (prev_alloc == BLOCK_ALLOCATED && next_alloc == BLOCK_ALLOCATED) {
-
+    // a block behind a free block already has its prev alloc bit cleared,
+    // only an allocated next block has to learn that bp is free
+    if (prev_alloc && next_alloc == BLOCK_ALLOCATED) {
+        CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        insert_to_free_list(bp);
     }
-    else if (prev_alloc == BLOCK_ALLOCATED && next_alloc == BLOCK_FREE) {
+    else if (prev_alloc && next_alloc == BLOCK_FREE) {
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        remove_from_free_list(NEXT_BLKP(bp));
-        PUT(HDRP(bp), PACK(size, BLOCK_FREE));
-        PUT(FTRP(bp), PACK(size, BLOCK_FREE));
+        replace_free_block(NEXT_BLKP(bp), bp, size, PREV_ALLOCATED);
     }
-    else if (prev_alloc == BLOCK_FREE && next_alloc == BLOCK_ALLOCATED) {
+    else if (next_alloc == BLOCK_ALLOCATED) {
+        CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        remove_from_free_list(PREV_BLKP(bp));
-        PUT(FTRP(bp), PACK(size, BLOCK_FREE));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, BLOCK_FREE));
         bp = PREV_BLKP(bp);
+        replace_free_block(bp, bp, size, PREV_ALLOCATED);
     }
     else {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        remove_from_free_list(PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
         remove_from_free_list(NEXT_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, BLOCK_FREE));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, BLOCK_FREE));
         bp = PREV_BLKP(bp);
+        replace_free_block(bp, bp, size, PREV_ALLOCATED);
     }
 
-    insert_to_free_list(bp);
     return bp;
 }
 
 /*
- * find_fit - find apporatiate free block to place, if none return NULL
- *  using first fit (since the free list are ordered, this is the same as best fit)
+ * list_fit - find apporatiate free block to place, if none return NULL
+ *  best fit within the class of `size` (it may hold smaller blocks), otherwise
+ *  the head of the next non-empty class, every block there is large enough.
+ *  the large class is searched for the exact best fit.
+ *  the next non-empty class comes from the bitmaps, no empty list is visited
  */
-static void *find_fit(size_t size)
+static void *list_fit(size_t size)
 {
-    char *root_pointer;
+    unsigned int i = get_size_class(size);
+    unsigned int fl = i / SL_COUNT;
+    unsigned int map;
+    char *root_pointer = free_list_pointer + i * WSIZE;
+    char *best = NULL;
     char *bp;
-    for (root_pointer = get_segregated_free_list_index(size); root_pointer != heap_listp - WSIZE; root_pointer += WSIZE) {
-        bp = GET(root_pointer);
-        while (bp != NULL)
-            if (GET_SIZE(HDRP(bp)) >= size) return bp;
-            else bp = GET(FREE_BLOCK_SUCC(bp));
+
+    if (i == LARGE_CLASS) return large_fit(size);
+
+    for (bp = GET(root_pointer); bp != NULL; bp = GET(FREE_BLOCK_SUCC(bp))) {
+        size_t bsize = GET_SIZE(HDRP(bp));
+        if (bsize == size) return bp;
+        if (bsize > size && (best == NULL || bsize < GET_SIZE(HDRP(best)))) best = bp;
+    }
+    if (best != NULL) return best;
+
+    // next non-empty class in the same range, else the first class of the next non-empty range
+    map = SL_MAP(fl) & (~0u << (i % SL_COUNT + 1));
+    if (map == 0) {
+        map = fl_bitmap & (~0u << (fl + 1));
+        if (map == 0) return NULL;
+        fl = __builtin_ctz(map);
+        if (fl == FL_COUNT) return large_fit(size);
+        map = SL_MAP(fl);
     }
-    return NULL;
+    return GET(free_list_pointer + (fl * SL_COUNT + __builtin_ctz(map)) * WSIZE);
+}
+
+/*
+ * find_fit - the block list_fit picks, or the wilderness where the treap would
+ *  have given it: nothing else fits, or the pick is a large block that the
+ *  wilderness is smaller than (at equal size the lower address wins)
+ */
+static void *find_fit(size_t size)
+{
+    char *bp = list_fit(size);
+    size_t wsize;
+
+    if (wilderness == NULL || (wsize = GET_SIZE(HDRP(wilderness))) < size) return bp;
+    if (bp == NULL || (GET_SIZE(HDRP(bp)) >= (1 << FL_LARGE) && wsize < GET_SIZE(HDRP(bp)))) return wilderness;
+    return bp;
+}
+
+/*
+ * grown_fit - the block find_fit picks, unless that is the free block ending
+ *  the heap behind the block mm_realloc grew last and another block fits,
+ *  which keeps that block growing in place
+ */
+static void *grown_fit(size_t size)
+{
+    char *bp = find_fit(size);
+    char *other;
+
+    if (grown == NULL || bp != NEXT_BLKP(grown) || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) return bp;
+    remove_from_free_list(bp);
+    other = find_fit(size);
+    insert_to_free_list(bp);
+    return other != NULL ? other : bp;
 }
 
 /*
@@ -250,24 +697,17 @@ static void *find_fit(size_t size)
 static void place(void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 
-    remove_from_free_list(bp);
-
-    // 2 * DSIZE (4 words) are needed for a new free block
+    // 2 * DSIZE (4 words) are needed for a new free block, it takes bp's place
     if ((csize - asize) >= (2 * DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, BLOCK_ALLOCATED));
-        PUT(FTRP(bp), PACK(asize, BLOCK_ALLOCATED));
-        bp = NEXT_BLKP(bp);
-
-        PUT(HDRP(bp), PACK(csize - asize, BLOCK_FREE));
-        PUT(FTRP(bp), PACK(csize - asize, BLOCK_FREE));
-        PUT(FREE_BLOCK_PRED(bp), NULL);
-        PUT(FREE_BLOCK_SUCC(bp), NULL);
-        insert_to_free_list(bp);
+        replace_free_block(bp, (char *)bp + asize, csize - asize, PREV_ALLOCATED);
+        PUT(HDRP(bp), PACK(asize, prev_alloc | BLOCK_ALLOCATED));
     }
     else {
-        PUT(HDRP(bp), PACK(csize, BLOCK_ALLOCATED));
-        PUT(FTRP(bp), PACK(csize, BLOCK_ALLOCATED));
+        remove_from_free_list(bp);
+        PUT(HDRP(bp), PACK(csize, prev_alloc | BLOCK_ALLOCATED));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     }
 }
 
@@ -278,145 +718,349 @@ static void place_realloc(void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));
 
-    remove_from_free_list(bp);
+    // bp is allocated, it is on no free list
 
     // 2 * DSIZE (4 words) are needed for a new free block
     if ((csize - asize) >= (2 * DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, BLOCK_ALLOCATED));
-        PUT(FTRP(bp), PACK(asize, BLOCK_ALLOCATED));
+        PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_ALLOCATED));
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, BLOCK_FREE));
+        PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOCATED | BLOCK_FREE));
         PUT(FTRP(bp), PACK(csize - asize, BLOCK_FREE));
         PUT(FREE_BLOCK_PRED(bp), NULL);
         PUT(FREE_BLOCK_SUCC(bp), NULL);
         coalesce(bp);                   // there might be adjacent free blocks
     }
-    else {
-        PUT(HDRP(bp), PACK(csize, BLOCK_ALLOCATED));
-        PUT(FTRP(bp), PACK(csize, BLOCK_ALLOCATED));
-    }
 }
 
 /*
  * coalesce_realloc - if possible, realloc given block using adjacent free blocks
+ *  the next block alone is used if it is large enough, otherwise all of the
+ *  next block and the tail of the previous one, moving the payload down.
+ *  a remainder of at least 4 words stays free, in front of or behind the block
  */
 static void *coalesce_realloc(void *bp, size_t new_size)
 {
     size_t orig_size = GET_SIZE(HDRP(bp));
-    size_t max_adj_size;
+    char *prev_bp, *next_bp = NEXT_BLKP(bp);
+    size_t prev_size = 0, next_size = 0;
+    size_t total_size;
+    unsigned int prev_alloc;
+
+    if (!GET_PREV_ALLOC(HDRP(bp))) prev_size = GET_SIZE((char *)bp - DSIZE);
+    if (GET_ALLOC(HDRP(next_bp)) == BLOCK_FREE) next_size = GET_SIZE(HDRP(next_bp));
+
+    if (orig_size + next_size >= new_size) {
+        remove_from_free_list(next_bp);
+        total_size = orig_size + next_size;
+        if (total_size >= new_size + 2 * DSIZE) {
+            PUT(HDRP(bp), PACK(new_size, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_ALLOCATED));
+            next_bp = NEXT_BLKP(bp);
+            PUT(HDRP(next_bp), PACK(total_size - new_size, PREV_ALLOCATED | BLOCK_FREE));
+            PUT(FTRP(next_bp), PACK(total_size - new_size, BLOCK_FREE));
+            PUT(FREE_BLOCK_PRED(next_bp), NULL);
+            PUT(FREE_BLOCK_SUCC(next_bp), NULL);
+            insert_to_free_list(next_bp);
+        }
+        else {
+            PUT(HDRP(bp), PACK(total_size, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_ALLOCATED));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        }
+        return bp;
+    }
 
-    unsigned int prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-    unsigned int next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    total_size = prev_size + orig_size + next_size;
+    if (prev_size == 0 || total_size < new_size) return NULL;
+
+    prev_bp = (char *)bp - prev_size;
+    prev_alloc = GET_PREV_ALLOC(HDRP(prev_bp));
+    remove_from_free_list(prev_bp);
+    if (next_size != 0) remove_from_free_list(next_bp);
+
+    if (total_size >= new_size + 2 * DSIZE) {
+        // the remainder stays free in front, the block moves to the end,
+        // its header goes first since insert_to_free_list looks at it
+        char *free_bp = prev_bp;
+        PUT(HDRP(free_bp), PACK(total_size - new_size, prev_alloc | BLOCK_FREE));
+        PUT(FTRP(free_bp), PACK(total_size - new_size, BLOCK_FREE));
+        prev_bp = NEXT_BLKP(free_bp);
+        PUT(HDRP(prev_bp), PACK(new_size, BLOCK_ALLOCATED));
+        PUT(FREE_BLOCK_PRED(free_bp), NULL);
+        PUT(FREE_BLOCK_SUCC(free_bp), NULL);
+        insert_to_free_list(free_bp);
+    }
+    else {
+        new_size = total_size;
+        PUT(HDRP(prev_bp), PACK(new_size, prev_alloc | BLOCK_ALLOCATED));
+    }
+
+    // use memmove instead of memcpy to handle the (possible) overlapped area,
+    // the new header is below bp so it could be written first
+    memmove(prev_bp, bp, orig_size - WSIZE);
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev_bp)));
+    return prev_bp;
+}
+
+/*
+ * in_slab - is bp an object of a slab
+ */
+static int in_slab(void *bp)
+{
+    size_t page = (size_t)(SLAB_OF(bp) - slab_base) >> SLAB_BITS;
+    if (page >= slab_map_pages) return 0;
+    return (GET(slab_map + (page / 32) * WSIZE) >> (page % 32)) & 1;
+}
+
+/*
+ * set_slab_page - mark or unmark the page at `slab` as a slab
+ */
+static void set_slab_page(char *slab, int on)
+{
+    size_t page = (size_t)(slab - slab_base) >> SLAB_BITS;
+    char *word = slab_map + (page / 32) * WSIZE;
+
+    if (on) PUT(word, GET(word) | (1u << (page % 32)));
+    else PUT(word, GET(word) & ~(1u << (page % 32)));
+}
+
+/*
+ * grow_slab_map - make the slab map cover `page`, at least doubling it
+ *  the slab list heads move along with it, the first call creates both.
+ *  returns 0 if there is no space for the new map
+ */
+static int grow_slab_map(size_t page)
+{
+    size_t words = MAX(slab_map_pages / 16, page / 32 + 1);
+    char *old_roots = slab_roots;
+    char *roots;
+
+    if ((roots = block_alloc((SLAB_CLASS_NUM + words) * WSIZE)) == NULL) return 0;
+    memset(roots, 0, (SLAB_CLASS_NUM + words) * WSIZE);
+    if (old_roots != NULL) memcpy(roots, old_roots, SLAB_CLASS_NUM * WSIZE + slab_map_pages / 8);
+
+    slab_roots = roots;
+    slab_map = roots + SLAB_CLASS_NUM * WSIZE;
+    slab_map_pages = words * 32;
+    if (old_roots != NULL) mm_free(old_roots);
+    return 1;
+}
 
-    if (prev_alloc == BLOCK_ALLOCATED && next_alloc == BLOCK_ALLOCATED) {
+/*
+ * slab_page - first page a slab can take in a free area starting with the header at `h`
+ *  the slab block's header is the word before the page, what is left in
+ *  front of it must be empty or a free block of at least 4 words
+ */
+static char *slab_page(char *h)
+{
+    char *slab = SLAB_OF(h + WSIZE + SLAB_SIZE - 1);
+
+    if (slab - WSIZE != h && slab - WSIZE - h < 2 * DSIZE) slab += SLAB_SIZE;
+    return slab;
+}
 
+/*
+ * carve_slab - turn the free area of `size` bytes with header at `h` into a slab
+ *  the area is on no free list, the parts in front of and behind the slab
+ *  block become free blocks (a tail of less than 4 words stays in the slab block)
+ */
+static char *carve_slab(char *h, size_t size, char *slab)
+{
+    size_t gap = slab - WSIZE - h;
+    size_t rest = size - gap - SLAB_SIZE;
+    size_t slab_size = SLAB_SIZE;
+    unsigned int prev_alloc = GET_PREV_ALLOC(h);
+
+    if (rest < 2 * DSIZE) {
+        slab_size += rest;
+        rest = 0;
     }
-    else if (prev_alloc == BLOCK_ALLOCATED && next_alloc == BLOCK_FREE) {
-        max_adj_size = orig_size + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        if (max_adj_size >= new_size + 2 * DSIZE) {
-            void *next_bp = NEXT_BLKP(bp);
-            remove_from_free_list(next_bp);
-            PUT(HDRP(next_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-            PUT(FTRP(next_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-            PUT(HDRP(NEXT_BLKP(next_bp)), PACK(max_adj_size - new_size, BLOCK_FREE));
-            PUT(FTRP(NEXT_BLKP(next_bp)), PACK(max_adj_size - new_size, BLOCK_FREE));
-            insert_to_free_list(NEXT_BLKP(next_bp));
 
-            PUT(FTRP(next_bp), PACK(new_size, BLOCK_ALLOCATED));
-            PUT(HDRP(bp), PACK(new_size, BLOCK_ALLOCATED));
-            return bp;
-        }
-        else if (max_adj_size >= new_size) {
-            void *next_bp = NEXT_BLKP(bp);
-            remove_from_free_list(next_bp);
-            PUT(FTRP(next_bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-            PUT(HDRP(bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-            return bp;
-        }
+    // the slab header goes first, insert_to_free_list looks at the block after the gap
+    PUT(HDRP(slab), PACK(slab_size, (gap != 0 ? 0 : prev_alloc) | BLOCK_ALLOCATED));
+
+    if (gap != 0) {
+        PUT(h, PACK(gap, prev_alloc | BLOCK_FREE));
+        PUT(h + gap - WSIZE, PACK(gap, BLOCK_FREE));
+        PUT(FREE_BLOCK_PRED(h + WSIZE), NULL);
+        PUT(FREE_BLOCK_SUCC(h + WSIZE), NULL);
+        insert_to_free_list(h + WSIZE);
     }
-    else if (prev_alloc == BLOCK_FREE && next_alloc == BLOCK_ALLOCATED) {
-        max_adj_size = orig_size + GET_SIZE(FTRP(PREV_BLKP(bp)));
-        if (max_adj_size >= new_size + 2 * DSIZE ) {
-            void *prev_bp = PREV_BLKP(bp);
-            remove_from_free_list(prev_bp);
-            PUT(FTRP(prev_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-            prev_bp = PREV_BLKP(bp);
-            PUT(HDRP(prev_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-            PUT(prev_bp - DSIZE, PACK(max_adj_size - new_size, BLOCK_FREE));
-            PUT(HDRP(PREV_BLKP(prev_bp)), PACK(max_adj_size - new_size, BLOCK_FREE));
-            // use memmove instead of memcpy to handle the (possible) overlapped area
-            insert_to_free_list(PREV_BLKP(prev_bp));
-
-            PUT(HDRP(prev_bp), PACK(new_size, BLOCK_ALLOCATED));
-            PUT(FTRP(bp), PACK(new_size, BLOCK_ALLOCATED));
-
-            memmove(prev_bp, bp, orig_size - DSIZE);
-
-            return prev_bp;
-        }
-        else if (max_adj_size >= new_size) {
-            void *prev_bp = PREV_BLKP(bp);
-            remove_from_free_list(prev_bp);
-            PUT(HDRP(prev_bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-            PUT(FTRP(bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-            memmove(prev_bp, bp, orig_size - DSIZE);
-            return prev_bp;
+
+    if (rest != 0) {
+        char *bp = NEXT_BLKP(slab);
+        PUT(HDRP(bp), PACK(rest, PREV_ALLOCATED | BLOCK_FREE));
+        PUT(FTRP(bp), PACK(rest, BLOCK_FREE));
+        PUT(FREE_BLOCK_PRED(bp), NULL);
+        PUT(FREE_BLOCK_SUCC(bp), NULL);
+        insert_to_free_list(bp);
+    }
+    else SET_PREV_ALLOC(HDRP(NEXT_BLKP(slab)));
+
+    return slab;
+}
+
+/*
+ * new_slab - get a page for a slab of class `cls` and link it, NULL if there is none
+ *  the slab is carved from a free block holding an aligned page, otherwise at
+ *  the end of the heap, from the last block if it is free
+ */
+static char *new_slab(unsigned int cls)
+{
+    char *bp, *h, *slab, *end;
+    size_t page, size;
+
+    // growing the map may move the end of the heap, so look again after it
+    for (;;) {
+        end = (char *)mem_heap_hi() + 1;
+        // a free block of a page fits if it is aligned (freed slabs are), one of 2 pages always fits
+        bp = grown_fit(SLAB_SIZE);
+        if (bp != NULL && slab_page(HDRP(bp)) + SLAB_SIZE - WSIZE > HDRP(bp) + GET_SIZE(HDRP(bp)))
+            bp = grown_fit(2 * SLAB_SIZE + 2 * DSIZE);
+        if (bp != NULL) h = HDRP(bp);
+        else {
+            h = end - WSIZE;                        // epilogue header
+            if (!GET_PREV_ALLOC(h)) h = HDRP(PREV_BLKP(end));
         }
+        slab = slab_page(h);
+        page = (size_t)(slab - slab_base) >> SLAB_BITS;
+        if (page < slab_map_pages) break;
+        if (!grow_slab_map(page)) return NULL;
     }
+
+    if (bp != NULL) size = GET_SIZE(h);
     else {
-        max_adj_size = orig_size + GET_SIZE(FTRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        if (max_adj_size >= new_size) {
-            void *next_bp = NEXT_BLKP(bp);
-            size_t size_next = GET_SIZE(HDRP(next_bp));
-            if (size_next >= new_size - orig_size + 2 * DSIZE) {
-                remove_from_free_list(next_bp);
-                PUT(HDRP(next_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-                PUT(FTRP(next_bp), PACK(new_size - orig_size, BLOCK_ALLOCATED));
-                PUT(HDRP(NEXT_BLKP(next_bp)), PACK(size_next - (new_size - orig_size), BLOCK_FREE));
-                PUT(FTRP(NEXT_BLKP(next_bp)), PACK(size_next - (new_size - orig_size), BLOCK_FREE));
-                PUT(FREE_BLOCK_PRED(NEXT_BLKP(next_bp)), NULL);
-                PUT(FREE_BLOCK_SUCC(NEXT_BLKP(next_bp)), NULL);
-                insert_to_free_list(NEXT_BLKP(next_bp));
-
-                PUT(FTRP(next_bp), PACK(new_size, BLOCK_ALLOCATED));
-                PUT(HDRP(bp), PACK(new_size, BLOCK_ALLOCATED));
-                return bp;
-            }
-            else if (size_next >= new_size - orig_size) {
-                remove_from_free_list(next_bp);
-                PUT(FTRP(next_bp), PACK(orig_size + size_next, BLOCK_ALLOCATED));
-                PUT(HDRP(bp), PACK(orig_size + size_next, BLOCK_ALLOCATED));
-                return bp;
-            }
-            else remove_from_free_list(next_bp);
-            
-            size_t size_left = new_size - orig_size - size_next;
-            void *prev_bp = PREV_BLKP(bp);
-            size_t size_prev = GET_SIZE(FTRP(prev_bp));
-            if (size_prev >= size_left + 2 * DSIZE) {
-                remove_from_free_list(prev_bp);
-                PUT(FTRP(prev_bp), PACK(size_left, BLOCK_ALLOCATED));
-                prev_bp = PREV_BLKP(bp);
-                PUT(HDRP(prev_bp), PACK(size_left, BLOCK_ALLOCATED));
-                PUT(prev_bp - DSIZE, PACK(size_prev - size_left, BLOCK_FREE));
-                PUT(HDRP(PREV_BLKP(prev_bp)), PACK(size_prev - size_left, BLOCK_FREE));
-                insert_to_free_list(PREV_BLKP(prev_bp));
-
-                PUT(FTRP(next_bp), PACK(new_size, BLOCK_ALLOCATED));
-                PUT(HDRP(prev_bp), PACK(new_size, BLOCK_ALLOCATED));
-                memmove(prev_bp, bp, orig_size - DSIZE);
-                return prev_bp;
-            }
-            else {
-                remove_from_free_list(prev_bp);
-                PUT(FTRP(next_bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-                PUT(HDRP(prev_bp), PACK(max_adj_size, BLOCK_ALLOCATED));
-                memmove(prev_bp, bp, orig_size - DSIZE);
-                return prev_bp;
-            }
+        if (slab + SLAB_SIZE > end) {
+            if (mem_sbrk(slab + SLAB_SIZE - end) == (void *) -1) return NULL;
+            end = slab + SLAB_SIZE;
+            PUT(end - WSIZE, PACK(0, BLOCK_ALLOCATED));     // new epilogue header
         }
+        size = end - WSIZE - h;
+    }
+    if (GET_ALLOC(h) == BLOCK_FREE) remove_from_free_list(h + WSIZE);
+
+    carve_slab(h, size, slab);
+    set_slab_page(slab, 1);
+
+    PUT(SLAB_OBJ_SIZE(slab), (cls + 1) * DSIZE);
+    PUT(SLAB_FREE(slab), NULL);
+    PUT(SLAB_BUMP(slab), slab + SLAB_HSIZE);
+    PUT(SLAB_LIVE(slab), 0);
+    slab_link(slab);
+    return slab;
+}
+
+/*
+ * slab_link - push a slab with free objects to the list of its class
+ */
+static void slab_link(char *slab)
+{
+    char *root_pointer = slab_roots + (GET(SLAB_OBJ_SIZE(slab)) / DSIZE - 1) * WSIZE;
+    char *next_slab = GET(root_pointer);
+
+    PUT(SLAB_PREV(slab), NULL);
+    PUT(SLAB_NEXT(slab), next_slab);
+    if (next_slab != NULL) PUT(SLAB_PREV(next_slab), slab);
+    PUT(root_pointer, slab);
+}
+
+/*
+ * slab_unlink - remove a slab from the list of its class
+ */
+static void slab_unlink(char *slab)
+{
+    char *prev_slab = GET(SLAB_PREV(slab));
+    char *next_slab = GET(SLAB_NEXT(slab));
+
+    if (prev_slab != NULL) PUT(SLAB_NEXT(prev_slab), next_slab);
+    else PUT(slab_roots + (GET(SLAB_OBJ_SIZE(slab)) / DSIZE - 1) * WSIZE, next_slab);
+    if (next_slab != NULL) PUT(SLAB_PREV(next_slab), prev_slab);
+}
+
+/*
+ * slab_alloc - take an object from the first slab of class `cls`
+ *  a free object if there is one, else the next object never used.
+ *  a slab leaves its list when it is full. the requests of a class not yet
+ *  served by slabs stay plain blocks
+ */
+static void *slab_alloc(unsigned int cls)
+{
+    char *slab = NULL;
+    size_t obj_size = (cls + 1) * DSIZE;
+    char *bp;
+
+    if (!((slab_classes >> cls) & 1)) return NULL;
+    if (slab_roots != NULL) slab = GET(slab_roots + cls * WSIZE);
+    if (slab == NULL && (slab = new_slab(cls)) == NULL) return NULL;
+
+    if ((bp = GET(SLAB_FREE(slab))) != NULL) PUT(SLAB_FREE(slab), GET(bp));
+    else {
+        bp = GET(SLAB_BUMP(slab));
+        PUT(SLAB_BUMP(slab), bp + obj_size);
+    }
+    PUT(SLAB_LIVE(slab), GET(SLAB_LIVE(slab)) + 1);
+
+    if (GET(SLAB_FREE(slab)) == NULL && GET(SLAB_BUMP(slab)) + obj_size > SLAB_END(slab)) slab_unlink(slab);
+    return bp;
+}
+
+/*
+ * slab_free - return an object to its slab
+ *  a full slab joins its list again, an empty one is freed as a block
+ *  unless it is the only slab of its class with free objects
+ */
+static void slab_free(void *bp)
+{
+    char *slab = SLAB_OF(bp);
+    unsigned int live = GET(SLAB_LIVE(slab)) - 1;
+
+    if (GET(SLAB_FREE(slab)) == NULL && GET(SLAB_BUMP(slab)) + GET(SLAB_OBJ_SIZE(slab)) > SLAB_END(slab))
+        slab_link(slab);
+
+    PUT(bp, GET(SLAB_FREE(slab)));
+    PUT(SLAB_FREE(slab), bp);
+    PUT(SLAB_LIVE(slab), live);
+
+    if (live == 0 && (GET(SLAB_PREV(slab)) != NULL || GET(SLAB_NEXT(slab)) != NULL)) {
+        slab_unlink(slab);
+        set_slab_page(slab, 0);
+        mm_free(slab);
+    }
+}
+
+/*
+ * set_small_class - record the slab class of the `size` byte request the allocated block bp serves
+ *  a block of B bytes serves requests of class B / 8 - 2 or the one above,
+ *  SMALL_UPPER in its header tells which. a block that kept 8 bytes of a free
+ *  block too small to split may count one class above its request
+ */
+static inline void set_small_class(void *bp, size_t size)
+{
+    unsigned int header = GET(HDRP(bp)) & ~SMALL_UPPER;
+
+    if ((size - 1) / DSIZE > (header & ~0x7) / DSIZE - 2) header |= SMALL_UPPER;
+    PUT(HDRP(bp), header);
+}
+
+/*
+ * count_small - count the allocated block bp in (up) or out of the live plain blocks of its slab class
+ *  the class comes from the size and SMALL_UPPER, larger blocks serve none.
+ *  a class is served by slabs from the count SLAB_FIRST names on, and no longer
+ *  counted, so a count never passes 255
+ */
+static inline void count_small(void *bp, int up)
+{
+    unsigned int header = GET(HDRP(bp));
+    unsigned int cls = (header & ~0x7) / DSIZE - 2 + ((header & SMALL_UPPER) != 0);
+    unsigned long long *word;
+    unsigned int n;
+
+    if (cls >= SLAB_CLASS_NUM || ((slab_classes >> cls) & 1)) return;
+    word = cls < 8 ? &small_live_lo : &small_live_hi;
+    n = (*word >> (cls % 8 * 8)) & 0xff;
+    if (!up) *word -= 1ULL << (cls % 8 * 8);
+    else {
+        *word += 1ULL << (cls % 8 * 8);
+        if (SLAB_FIRST(cls, n + 1)) slab_classes |= 1u << cls;
     }
-    return NULL;
 }
 
 /* 
@@ -424,67 +1068,92 @@ static void *coalesce_realloc(void *bp, size_t new_size)
  */
 int mm_init(void)
 {
-    // allocate 12 words for free list pointer, prologue block and epilogue block
-    if ((heap_listp = mem_sbrk(12 * WSIZE)) == (void *) -1) return -1;
-
-    PUT(heap_listp, NULL);                  // block size <= 32
-    PUT(heap_listp + WSIZE, NULL);          // 32 < block size <= 64
-    PUT(heap_listp + 2 * WSIZE, NULL);      // 64 < block size <= 128
-    PUT(heap_listp + 3 * WSIZE, NULL);      // 128 < block size <= 256
-    PUT(heap_listp + 4 * WSIZE, NULL);      // 256 < block size <= 512
-    PUT(heap_listp + 5 * WSIZE, NULL);      // 512 < block size <= 1024
-    PUT(heap_listp + 6 * WSIZE, NULL);      // 1024 < block size <= 2048
-    PUT(heap_listp + 7 * WSIZE, NULL);      // 2048 < block size <= 4096
-    PUT(heap_listp + 8 * WSIZE, NULL);      // block size > 4096
-    PUT(heap_listp + 9 * WSIZE, PACK(DSIZE, BLOCK_ALLOCATED));  // prologue block header
-    PUT(heap_listp + 10 * WSIZE, PACK(DSIZE, BLOCK_ALLOCATED)); // prologue block footer
-    PUT(heap_listp + 11 * WSIZE, PACK(0, BLOCK_ALLOCATED));     // epilogue block
+    int i;
+
+    // allocate CLASS_NUM words for free list pointers, 3 for prologue block and epilogue block
+    // CLASS_NUM is odd, so the first block stays double word aligned
+    if ((heap_listp = mem_sbrk((CLASS_NUM + 3) * WSIZE)) == (void *) -1) return -1;
+
+    for (i = 0; i < CLASS_NUM; ++i)
+        PUT(heap_listp + i * WSIZE, NULL);  // free list roots, the last one is the large class
+    PUT(heap_listp + CLASS_NUM * WSIZE, PACK(DSIZE, BLOCK_ALLOCATED));        // prologue block header
+    PUT(heap_listp + (CLASS_NUM + 1) * WSIZE, PACK(DSIZE, BLOCK_ALLOCATED));  // prologue block footer
+    PUT(heap_listp + (CLASS_NUM + 2) * WSIZE, PACK(0, PREV_ALLOCATED | BLOCK_ALLOCATED));  // epilogue block
 
     free_list_pointer = heap_listp;
-    heap_listp += 10 * WSIZE;
+    wilderness = NULL;
+    large_count = 0;
+    large_tree = 0;
+    grown = NULL;
+    slab_roots = NULL;
+    slab_map = NULL;
+    slab_map_pages = 0;
+    slab_base = SLAB_OF(heap_listp);
+    fl_bitmap = 0;
+    sl_bitmap = 0;
+    slab_classes = 0;
+    small_live_lo = 0;
+    small_live_hi = 0;
+    heap_listp += (CLASS_NUM + 1) * WSIZE;
 
     if (extend_heap(CHUNKSIZE / DSIZE) == NULL) return -1;
     return 0;
 }
 
-/* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+/*
+ * block_alloc - allocate a block from the free lists, extending the heap if needed
  */
-void *mm_malloc(size_t size)
+static void *block_alloc(size_t size)
 {
     size_t asize;
     size_t extendsize;
     char *bp;
 
-    if (size == 0) return NULL;
-
-    // adjust block size to include overhead and alignment requirements
-    if (size <= DSIZE) asize = 2 * DSIZE;
-    // minimum allocated block size is 4 words (alignment requirement)
-    else asize = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
-
-    if ((bp = find_fit(asize)) != NULL) {
+    // adjust block size to include the header and alignment requirements
+    // minimum block size is 4 words, so that it can be freed
+    asize = MAX(2 * DSIZE, ALIGN(size + WSIZE));
 
-        place(bp, asize);
-        return bp;
+    if ((bp = find_fit(asize)) == NULL) {
+        extendsize = MAX(asize, CHUNKSIZE);
+        if ((bp = extend_heap(extendsize / DSIZE)) == NULL)
+            return NULL;
     }
 
-    extendsize = MAX(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / DSIZE)) == NULL)
-        return NULL;
-
     place(bp, asize);
+    if (asize <= SLAB_MAX + DSIZE) {
+        set_small_class(bp, size);
+        count_small(bp, 1);
+    }
     return bp;
 }
 
+/* 
+ * mm_malloc - Allocate a block by incrementing the brk pointer.
+ *     Always allocate a block whose size is a multiple of the alignment.
+ */
+void *mm_malloc(size_t size)
+{
+    char *bp;
+
+    if (size == 0) return NULL;
+    if (size <= SLAB_MAX && (bp = slab_alloc((size - 1) / DSIZE)) != NULL) return bp;
+    return block_alloc(size);
+}
+
 /*
  * mm_free - Freeing a block does nothing.
  */
 void mm_free(void *bp)
 {
+    if (in_slab(bp)) {
+        slab_free(bp);
+        return;
+    }
+    if (bp == grown) grown = NULL;
+    count_small(bp, 0);
+
     size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, BLOCK_FREE));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_FREE));
     PUT(FTRP(bp), PACK(size, BLOCK_FREE));
     PUT(FREE_BLOCK_PRED(bp), NULL);
     PUT(FREE_BLOCK_SUCC(bp), NULL);
@@ -505,29 +1174,64 @@ void *mm_realloc(void *bp, size_t size)
         return NULL;
     }
 
+    // a slab object keeps its place while it fits, else it is copied out
+    if (in_slab(bp)) {
+        size_t obj_size = GET(SLAB_OBJ_SIZE(SLAB_OF(bp)));
+        char *new_bp;
+        if (size <= obj_size) return bp;
+        if ((new_bp = mm_malloc(size)) == NULL) return NULL;
+        memcpy(new_bp, bp, obj_size);
+        slab_free(bp);
+        return new_bp;
+    }
+
     size_t asize;
 
-    // adjust block size to include overhead and alignment requirements
-    if (size <= DSIZE) asize = 2 * DSIZE;
-        // minimum allocated block size is 4 words (alignment requirement)
-    else asize = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+    // adjust block size to include the header and alignment requirements
+    // minimum block size is 4 words, so that it can be freed
+    asize = MAX(2 * DSIZE, ALIGN(size + WSIZE));
 
 
     size_t orig_size = GET_SIZE(HDRP(bp));
-
-    if (orig_size == asize) return bp;
-    if (orig_size > asize) {
-        place_realloc(bp, asize);
-        return bp;
+    char *new_bp = bp;
+
+    // the block may change its slab class, it is counted in again with its new size
+    if (orig_size <= SLAB_MAX + DSIZE) count_small(bp, 0);
+
+    if (orig_size > asize) place_realloc(bp, asize);
+    else if (orig_size < asize) {
+        // the block ends the heap (maybe followed by one free block that is too small):
+        // grow the heap under it, before coalesce_realloc would move it into a free block in front
+        size_t tail_size = orig_size;
+        char *next_bp = NEXT_BLKP(bp);
+        if (GET_ALLOC(HDRP(next_bp)) == BLOCK_FREE) {
+            tail_size += GET_SIZE(HDRP(next_bp));
+            next_bp = NEXT_BLKP(next_bp);
+        }
+        if (GET_SIZE(HDRP(next_bp)) == 0 && tail_size < asize) {
+            if (mem_sbrk(asize - tail_size) == (void *) -1) {
+                count_small(bp, 1);
+                return NULL;
+            }
+            if (tail_size > orig_size) remove_from_free_list(NEXT_BLKP(bp));
+            PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | BLOCK_ALLOCATED));
+            PUT(HDRP(NEXT_BLKP(bp)), PACK(0, PREV_ALLOCATED | BLOCK_ALLOCATED));   // new epilogue header
+        }
+        else if ((new_bp = coalesce_realloc(bp, asize)) == NULL) {
+            count_small(bp, 1);
+            if ((new_bp = mm_malloc(size)) == NULL) return NULL;
+            memcpy(new_bp, bp, orig_size - WSIZE);
+            mm_free(bp);
+            if (!in_slab(new_bp)) grown = new_bp;
+            return new_bp;
+        }
+        // remember the grown block, grown_fit keeps other blocks from its back while it ends the heap
+        grown = new_bp;
     }
 
-    char *new_bp = coalesce_realloc(bp, asize);
-
-    if (new_bp != NULL) return new_bp;
-    else {
-        new_bp = mm_malloc(size);
-        memcpy(new_bp, bp, orig_size - DSIZE);
-        mm_free(bp);
-        return new_bp;
+    if (asize <= SLAB_MAX + DSIZE) {
+        set_small_class(new_bp, size);
+        count_small(new_bp, 1);
     }
+    return new_bp;
 }
\ No newline at end of file